@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "voxels.h"
+#include "model.h"
+#include "physics.h"
+#include "logic.h"
+
+// the benchmarks and checks that used to sit in init, as a program of their own.
+// It never draws anything, but chunks are still uploaded as they're meshed, so it
+// makes a hidden window for the context. Exits with 1 if a check fails
+
+extern int useMeshing;
+
+// these belong to the game, and the bench doesn't have a frame to draw
+double deltaTime = 0.0;
+int frame_buffer_width = 0, frame_buffer_height = 0;
+
+void drawMesh(Mesh *mesh) {}
+void drawInstances(Mesh *mesh, mat4 modelMatrix, GLuint instances, int first, int count) {}
+
+// meshing every chunk of the world over and over
+static void benchMeshing() {
+    World *meshWorld = readWorld("worlds/saved");
+    double before;
+    int i, j;
+
+    useMeshing = 1;
+    before = glfwGetTime();
+    for (i = 0; i < 100; i++) {
+        for (j = 0; j < meshWorld->num_chunks; j++) {
+            renderChunk(meshWorld->chunks[j]);
+        }
+    }
+    printf("Benchmark took %.2f seconds\n", glfwGetTime() - before);
+
+    freeWorld(meshWorld);
+}
+
+// block layout and loading. Run it once as is and once built with -DMORTON_ORDER,
+// or with -DLOG_CHUNK_SIZE=5 or 6 to compare chunk sizes
+static void benchLayout() {
+    World *benchWorld = readWorld("worlds/saved_logic");
+    Player *benchPlayer = createPlayer(benchWorld);
+    unsigned long memory = 0;
+    double before;
+    int i, j, draws = 0;
+
+    for (j = 0; j < benchWorld->num_chunks; j++) {
+        memory += chunkMemory(benchWorld->chunks[j]);
+        draws += benchWorld->chunks[j]->mesh->size != 0;
+    }
+    printf("%d chunks %d blocks wide, %d draw calls, %lu KB\n",
+           benchWorld->num_chunks, CHUNK_SIZE, draws, memory / 1024);
+
+    deltaTime = 1.0 / 60;
+
+    before = glfwGetTime();
+    for (i = 0; i < 20; i++) {
+        freeWorld(readWorld("worlds/saved_logic"));
+    }
+    printf("Loading took %.3f seconds\n", glfwGetTime() - before);
+
+    before = glfwGetTime();
+    for (i = 0; i < 20; i++) {
+        for (j = 0; j < benchWorld->num_chunks; j++) {
+            renderChunk(benchWorld->chunks[j]);
+        }
+    }
+    printf("Meshing took %.3f seconds\n", glfwGetTime() - before);
+
+    // each chunk the fill touches is only meshed once
+    before = glfwGetTime();
+    {
+        World *fillBench = createWorld(4);
+        Edit *edit = beginEdit(fillBench);
+
+        fillRegion(edit, 0, 0, 0, 64, 64, 64, (Block){1, {{200, 200, 200, 255}}, NULL, NULL});
+        commitEdit(edit);
+        freeWorld(fillBench);
+    }
+    printf("Filling took %.3f seconds\n", glfwGetTime() - before);
+
+    // drop the player onto the floor over and over
+    before = glfwGetTime();
+    for (i = 0; i < 100000; i++) {
+        copy_v3(benchPlayer->position, (vec3){benchWorld->size * CHUNK_WIDTH / 2, 2 * CHUNK_WIDTH, benchWorld->size * CHUNK_WIDTH / 2});
+        copy_v3(benchPlayer->velocity, (vec3){0.1, -2 * CHUNK_WIDTH / deltaTime, 0.1});
+        collidePlayer(benchPlayer, benchWorld);
+    }
+    printf("Collision took %.3f seconds\n", glfwGetTime() - before);
+
+    before = glfwGetTime();
+    runLogicSteps(benchWorld, 1000);
+    printf("Logic took %.3f seconds\n", glfwGetTime() - before);
+
+    freePlayer(benchPlayer);
+    freeWorld(benchWorld);
+    deltaTime = 0.0;
+}
+
+// placing the gate models, the way addRenderedModel used to a vertex at a time,
+// against addRenderedModel itself, for every model and turn
+static void benchGateModels() {
+    GLfloat *expected[2], *actual[2], *colors;
+    float error = 0, diff;
+    mat4 *rotate;
+    Model *model;
+    double before, looped = 0, batched = 0;
+    int type, inputs, r, i, k, max_points = 0;
+
+    for (type = 0; type < NUM_GATES; type++)
+        for (inputs = 0; inputs < 64; inputs++)
+            if (getLogicModel(type, inputs)->n_points > max_points)
+                max_points = getLogicModel(type, inputs)->n_points;
+
+    for (k = 0; k < 2; k++) {
+        expected[k] = malloc(max_points * sizeof(GLfloat));
+        actual[k] = malloc(max_points * sizeof(GLfloat));
+    }
+    colors = malloc(max_points * sizeof(GLfloat));
+
+    for (type = 0; type < NUM_GATES; type++) {
+        for (inputs = 0; inputs < 64; inputs++) {
+            model = getLogicModel(type, inputs);
+
+            for (r = 0; r < 64; r++) {
+                rotate = getRotationMatrix(r);
+
+                before = glfwGetTime();
+                for (i = 0; i < model->n_points; i += 3) {
+                    copy_v3(&expected[0][i], &model->points[i]);
+                    translate_v3f(&expected[0][i], -MODEL_WIDTH/2.0, -MODEL_WIDTH/2.0, -MODEL_WIDTH/2.0);
+                    multiply_v3_m4(&expected[0][i], *rotate, 1.0);
+                    translate_v3f(&expected[0][i], MODEL_WIDTH/2.0, MODEL_WIDTH/2.0, MODEL_WIDTH/2.0);
+                    scale_v3(&expected[0][i], 1.0 / MODEL_SIZE);
+                    translate_v3v(&expected[0][i], (vec3){r, 1, 2});
+                    copy_v3(&expected[1][i], &model->normals[i]);
+                    multiply_v3_m4(&expected[1][i], *rotate, 1.0);
+                }
+                looped += glfwGetTime() - before;
+
+                before = glfwGetTime();
+                addRenderedModel(model, actual[0], actual[1], colors, r, (vec3){r, 1, 2}, 1.0 / MODEL_SIZE);
+                batched += glfwGetTime() - before;
+
+                for (k = 0; k < 2; k++) {
+                    for (i = 0; i < model->n_points; i++) {
+                        diff = fabsf(expected[k][i] - actual[k][i]);
+                        if (diff > error)
+                            error = diff;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("Placing gate models took %.4f seconds a vertex at a time, %.4f batched (off by at most %g)\n",
+           looped, batched, error);
+
+    for (k = 0; k < 2; k++) {
+        free(expected[k]);
+        free(actual[k]);
+    }
+    free(colors);
+}
+
+// the binary mesher has to give exactly what the old mesher does, face for face.
+// This checks it against every chunk of worlds/saved, and times the two. Returns
+// the number of chunks that came out differently
+static int checkBinaryMeshing() {
+    World *meshWorld = readWorld("worlds/saved");
+    MeshScratch scratch = {NULL, NULL, NULL, 0};
+    GLfloat *expected[3], *actual[3];
+    unsigned int max_points = 0, size;
+    int i, j, k, n, bad = 0;
+    double before;
+
+    for (j = 0; j < meshWorld->num_chunks; j++) {
+        size = countChunkSize(meshWorld->chunks[j]) + 6 * 4 * 3;
+        if (size > max_points)
+            max_points = size;
+    }
+
+    for (k = 0; k < 3; k++) {
+        expected[k] = malloc(max_points * sizeof(GLfloat));
+        actual[k] = malloc(max_points * sizeof(GLfloat));
+    }
+
+    for (j = 0; j < meshWorld->num_chunks; j++) {
+        n = renderChunkWithMeshing(meshWorld->chunks[j], expected[0], expected[1], expected[2], (vec3){0, 0, 0}, 1.0);
+
+        if (renderChunkWithBinaryMeshing(meshWorld->chunks[j], &scratch, actual[0], actual[1], actual[2], (vec3){0, 0, 0}, 1.0) != n)
+            bad++;
+        else
+            for (k = 0; k < 3; k++)
+                bad += !!memcmp(expected[k], actual[k], n * sizeof(GLfloat));
+    }
+    printf("%d of %d chunks meshed differently\n", bad, meshWorld->num_chunks);
+
+    before = glfwGetTime();
+    for (i = 0; i < 100; i++)
+        for (j = 0; j < meshWorld->num_chunks; j++)
+            renderChunkWithMeshing(meshWorld->chunks[j], expected[0], expected[1], expected[2], (vec3){0, 0, 0}, 1.0);
+    printf("Greedy meshing took %.3f seconds\n", glfwGetTime() - before);
+
+    before = glfwGetTime();
+    for (i = 0; i < 100; i++)
+        for (j = 0; j < meshWorld->num_chunks; j++)
+            renderChunkWithBinaryMeshing(meshWorld->chunks[j], &scratch, actual[0], actual[1], actual[2], (vec3){0, 0, 0}, 1.0);
+    printf("Binary meshing took %.3f seconds\n", glfwGetTime() - before);
+
+    for (k = 0; k < 3; k++) {
+        free(expected[k]);
+        free(actual[k]);
+    }
+    freeMeshScratch(&scratch);
+    freeWorld(meshWorld);
+
+    return bad;
+}
+
+// chunks that are edited a block at a time only mesh the slices that changed.
+// This checks that the pieces add up to the whole mesh, and times setBlock.
+// Returns the number of chunks whose pieces didn't
+static int checkMeshPieces() {
+    World *editWorld = readWorld("worlds/saved");
+    MeshScratch pieces = {NULL, NULL, NULL, 0};
+    GLfloat *whole[3];
+    unsigned int size;
+    int i, j, k, n, bad = 0;
+    double before;
+    Chunk *chunk;
+
+    before = glfwGetTime();
+    for (i = 0; i < 1000; i++) {
+        chunk = editWorld->chunks[i % editWorld->num_chunks];
+        setBlock(chunk, rand() % CHUNK_SIZE, rand() % CHUNK_SIZE, rand() % CHUNK_SIZE,
+                 (rand() % 2) ? (Block){1, {{255, 0, 0, 255}}, NULL, NULL} : EMPTY_BLOCK);
+    }
+    printf("1000 blocks set in %.3f seconds\n", glfwGetTime() - before);
+
+    for (j = 0; j < editWorld->num_chunks; j++) {
+        chunk = editWorld->chunks[j];
+        size = countChunkSize(chunk) + 6 * 4 * 3;
+
+        for (k = 0; k < 3; k++)
+            whole[k] = malloc(size * sizeof(GLfloat));
+
+        n = buildChunkArrays(chunk, &pieces);
+
+        if (renderChunkCubes(chunk, &pieces, whole[0], whole[1], whole[2], (vec3){0, 0, 0}, 1.0) != n)
+            bad++;
+        else
+            bad += n && (memcmp(pieces.points, whole[0], n * sizeof(GLfloat)) ||
+                         memcmp(pieces.normals, whole[1], n * sizeof(GLfloat)) ||
+                         memcmp(pieces.colors, whole[2], n * sizeof(GLfloat)));
+
+        for (k = 0; k < 3; k++)
+            free(whole[k]);
+    }
+
+    freeMeshScratch(&pieces);
+    printf("%d of %d chunks meshed differently from their pieces\n", bad, editWorld->num_chunks);
+
+    freeWorld(editWorld);
+
+    return bad;
+}
+
+int main(void) {
+    GLFWwindow* window;
+    int bad = 0;
+
+    if (!glfwInit()) {
+        return EXIT_FAILURE;
+    }
+
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3); // OpenGL 3.3
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    window = glfwCreateWindow(1, 1, "Bench", NULL, NULL);
+    if (!window) {
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+
+    glfwMakeContextCurrent(window);
+
+    glewExperimental = GL_TRUE;
+    if (glewInit() != GLEW_OK) {
+        return EXIT_FAILURE;
+    }
+
+    initLogicModels();
+
+    benchMeshing();
+    benchLayout();
+    benchGateModels();
+    bad += checkBinaryMeshing();
+    bad += checkMeshPieces();
+
+    glfwTerminate();
+
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
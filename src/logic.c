@@ -8,6 +8,7 @@
 #include "model.h"
 #include "logic.h"
 #include "matrix.h"
+#include "pool.h"
 
 // lots of magic numbers.. :)
 // static unsigned long int outputs[NUM_GATES] = {
@@ -66,16 +67,23 @@ static unsigned char output_faces[NUM_GATES] = {
     0x09, 0x2D, 0x2D, 0x29, 0x28, 0x2D, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x21, 0x00
 };
 
+// the gate models are kept in a size 10 world
+#define GATES_SIZE 10
+
 int showLogic = 1;
 
 static Model *logic_models[NUM_GATES][64];
+static int logic_model_sizes[NUM_GATES];
 static mat4 rotation_matrices[4][4][4];
 
 static pthread_t thread;
-static int quitThread = 0;
+static int quitThread = 0; // only touched atomically
+
+// worlds can have thousands of logic blocks, so they aren't malloced one by one
+static Pool logicPool = POOL(Logic, 1024);
 
 Logic *createLogic() {
-    Logic *logic = calloc(1, sizeof(Logic));
+    Logic *logic = poolAlloc(&logicPool);
 
     logic->auto_orient = 1;
 
@@ -83,10 +91,10 @@ Logic *createLogic() {
 }
 
 void freeLogic(Logic *logic) {
-    free(logic);
+    poolFree(&logicPool, logic);
 }
 
-void initLogicBlock(Block *block, int orient, int type, int roll, int pitch, int yaw) {
+void initLogicBlock(Block *block, int type, int roll, int pitch, int yaw) {
     if (block->logic)
         freeLogic(block->logic);
 
@@ -96,8 +104,6 @@ void initLogicBlock(Block *block, int orient, int type, int roll, int pitch, int
     block->logic->pitch = pitch;
     block->logic->yaw = yaw;
 
-    if (orient) autoOrient(block);
-
     updateLogicModel(block);
 }
 
@@ -108,12 +114,36 @@ void initLogicModels() {
     World *world = readWorld("worlds/gates");
 
     // int i, j, x, y, z, r, g, b, p;
-    int i, j, r, p, y;
+    int i, j, n, r, p, y;
+    int gx, gy, gz;
+    Chunk *chunk;
 
     for (i=0; i < NUM_GATES; i++) {
         for (j=0; j < 64; j++) {
             model = createModel();
-            model->chunk = world->chunks[(i * 64) + j];
+
+            // the models are stored one after another in the gates world.
+            // empty ones aren't kept, so they keep the model's own chunk
+            n = (i * 64) + j;
+            gx = n / (GATES_SIZE * GATES_SIZE);
+            gy = (n / GATES_SIZE) % GATES_SIZE;
+            gz = n % GATES_SIZE;
+
+#if LOG_PARTS == 0
+            chunk = removeChunk(world, gx, gy, gz);
+
+            if (chunk) {
+                freeChunk(model->chunk);
+                model->chunk = chunk;
+            }
+#else
+            // with bigger chunks, each model is one part of a chunk
+            chunk = worldChunk(world, gx >> LOG_PARTS, gy >> LOG_PARTS, gz >> LOG_PARTS);
+
+            if (chunk)
+                copyChunkPart(model->chunk, chunk, (gx & PART_MASK) * MODEL_SIZE,
+                              (gy & PART_MASK) * MODEL_SIZE, (gz & PART_MASK) * MODEL_SIZE);
+#endif
             // for (x=0; x < CHUNK_SIZE; x++) {
             //     for (y=0; y < CHUNK_SIZE; y++) {
             //         for (z=0; z < CHUNK_SIZE; z++) {
@@ -126,6 +156,9 @@ void initLogicModels() {
             renderModel(model);
 
             logic_models[i][j] = model;
+
+            if (model->n_points > logic_model_sizes[i])
+                logic_model_sizes[i] = model->n_points;
         }
     }
 
@@ -174,8 +207,7 @@ void initLogicModels() {
     //
     // writeWorld(world, "worlds/gates");
 
-    free(world->chunks);
-    free(world);
+    freeWorld(world);
 
     // // World *world = createWorld(10);
     //
@@ -219,10 +251,20 @@ Model *getLogicModel(int type, int inputs) {
     return logic_models[type][inputs];
 }
 
+// the turns of logic blocks, numbered roll * 16 + pitch * 4 + yaw. Turn 0 doesn't turn
+mat4 *getRotationMatrix(int index) {
+    return &rotation_matrices[0][0][0] + index;
+}
+
+// the most points any of the models of the type has
+int logicModelSize(int type) {
+    return logic_model_sizes[type];
+}
+
 void freeLogicModels() {
     for (int i=0; i < NUM_GATES; i++) {
         for (int j=0; j < 64; j++) {
-            freeModel(logic_models[i][j]);
+            releaseModel(logic_models[i][j]);
         }
     }
 }
@@ -252,22 +294,31 @@ unsigned int rotate_outputs(unsigned int output, int roll, int pitch, int yaw) {
     return output;
 }
 
-void autoOrient(Block *block) {
+// orients block to fit its neighbors, as if it were at (x, y, z) in chunk.
+// block doesn't need to have been placed there yet.
+void autoOrient(Block *block, World *world, Chunk *chunk, int x, int y, int z) {
     if (block->logic) {
+        Logic *nb_pos_x = getNeighborLogic(world, chunk, x, y, z,  1,  0,  0);
+        Logic *nb_neg_x = getNeighborLogic(world, chunk, x, y, z, -1,  0,  0);
+        Logic *nb_pos_y = getNeighborLogic(world, chunk, x, y, z,  0,  1,  0);
+        Logic *nb_neg_y = getNeighborLogic(world, chunk, x, y, z,  0, -1,  0);
+        Logic *nb_pos_z = getNeighborLogic(world, chunk, x, y, z,  0,  0,  1);
+        Logic *nb_neg_z = getNeighborLogic(world, chunk, x, y, z,  0,  0, -1);
+
         unsigned int target_inputs =
-            ((block->nb_neg_z && block->nb_neg_z->logic && (rotate_outputs(output_faces[block->nb_neg_z->logic->type], block->nb_neg_z->logic->roll, block->nb_neg_z->logic->pitch, block->nb_neg_z->logic->yaw) >> 3) & 1) << 0) |
-            ((block->nb_neg_y && block->nb_neg_y->logic && (rotate_outputs(output_faces[block->nb_neg_y->logic->type], block->nb_neg_y->logic->roll, block->nb_neg_y->logic->pitch, block->nb_neg_y->logic->yaw) >> 4) & 1) << 1) |
-            ((block->nb_neg_x && block->nb_neg_x->logic && (rotate_outputs(output_faces[block->nb_neg_x->logic->type], block->nb_neg_x->logic->roll, block->nb_neg_x->logic->pitch, block->nb_neg_x->logic->yaw) >> 5) & 1) << 2) |
-            ((block->nb_pos_z && block->nb_pos_z->logic && (rotate_outputs(output_faces[block->nb_pos_z->logic->type], block->nb_pos_z->logic->roll, block->nb_pos_z->logic->pitch, block->nb_pos_z->logic->yaw) >> 0) & 1) << 3) |
-            ((block->nb_pos_y && block->nb_pos_y->logic && (rotate_outputs(output_faces[block->nb_pos_y->logic->type], block->nb_pos_y->logic->roll, block->nb_pos_y->logic->pitch, block->nb_pos_y->logic->yaw) >> 1) & 1) << 4) |
-            ((block->nb_pos_x && block->nb_pos_x->logic && (rotate_outputs(output_faces[block->nb_pos_x->logic->type], block->nb_pos_x->logic->roll, block->nb_pos_x->logic->pitch, block->nb_pos_x->logic->yaw) >> 2) & 1) << 5);
+            ((nb_neg_z && (rotate_outputs(output_faces[nb_neg_z->type], nb_neg_z->roll, nb_neg_z->pitch, nb_neg_z->yaw) >> 3) & 1) << 0) |
+            ((nb_neg_y && (rotate_outputs(output_faces[nb_neg_y->type], nb_neg_y->roll, nb_neg_y->pitch, nb_neg_y->yaw) >> 4) & 1) << 1) |
+            ((nb_neg_x && (rotate_outputs(output_faces[nb_neg_x->type], nb_neg_x->roll, nb_neg_x->pitch, nb_neg_x->yaw) >> 5) & 1) << 2) |
+            ((nb_pos_z && (rotate_outputs(output_faces[nb_pos_z->type], nb_pos_z->roll, nb_pos_z->pitch, nb_pos_z->yaw) >> 0) & 1) << 3) |
+            ((nb_pos_y && (rotate_outputs(output_faces[nb_pos_y->type], nb_pos_y->roll, nb_pos_y->pitch, nb_pos_y->yaw) >> 1) & 1) << 4) |
+            ((nb_pos_x && (rotate_outputs(output_faces[nb_pos_x->type], nb_pos_x->roll, nb_pos_x->pitch, nb_pos_x->yaw) >> 2) & 1) << 5);
         unsigned int target_outputs =
-            ((block->nb_neg_z && block->nb_neg_z->logic && (rotate_outputs(input_faces[block->nb_neg_z->logic->type], block->nb_neg_z->logic->roll, block->nb_neg_z->logic->pitch, block->nb_neg_z->logic->yaw) >> 3) & 1) << 0) |
-            ((block->nb_neg_y && block->nb_neg_y->logic && (rotate_outputs(input_faces[block->nb_neg_y->logic->type], block->nb_neg_y->logic->roll, block->nb_neg_y->logic->pitch, block->nb_neg_y->logic->yaw) >> 4) & 1) << 1) |
-            ((block->nb_neg_x && block->nb_neg_x->logic && (rotate_outputs(input_faces[block->nb_neg_x->logic->type], block->nb_neg_x->logic->roll, block->nb_neg_x->logic->pitch, block->nb_neg_x->logic->yaw) >> 5) & 1) << 2) |
-            ((block->nb_pos_z && block->nb_pos_z->logic && (rotate_outputs(input_faces[block->nb_pos_z->logic->type], block->nb_pos_z->logic->roll, block->nb_pos_z->logic->pitch, block->nb_pos_z->logic->yaw) >> 0) & 1) << 3) |
-            ((block->nb_pos_y && block->nb_pos_y->logic && (rotate_outputs(input_faces[block->nb_pos_y->logic->type], block->nb_pos_y->logic->roll, block->nb_pos_y->logic->pitch, block->nb_pos_y->logic->yaw) >> 1) & 1) << 4) |
-            ((block->nb_pos_x && block->nb_pos_x->logic && (rotate_outputs(input_faces[block->nb_pos_x->logic->type], block->nb_pos_x->logic->roll, block->nb_pos_x->logic->pitch, block->nb_pos_x->logic->yaw) >> 2) & 1) << 5);
+            ((nb_neg_z && (rotate_outputs(input_faces[nb_neg_z->type], nb_neg_z->roll, nb_neg_z->pitch, nb_neg_z->yaw) >> 3) & 1) << 0) |
+            ((nb_neg_y && (rotate_outputs(input_faces[nb_neg_y->type], nb_neg_y->roll, nb_neg_y->pitch, nb_neg_y->yaw) >> 4) & 1) << 1) |
+            ((nb_neg_x && (rotate_outputs(input_faces[nb_neg_x->type], nb_neg_x->roll, nb_neg_x->pitch, nb_neg_x->yaw) >> 5) & 1) << 2) |
+            ((nb_pos_z && (rotate_outputs(input_faces[nb_pos_z->type], nb_pos_z->roll, nb_pos_z->pitch, nb_pos_z->yaw) >> 0) & 1) << 3) |
+            ((nb_pos_y && (rotate_outputs(input_faces[nb_pos_y->type], nb_pos_y->roll, nb_pos_y->pitch, nb_pos_y->yaw) >> 1) & 1) << 4) |
+            ((nb_pos_x && (rotate_outputs(input_faces[nb_pos_x->type], nb_pos_x->roll, nb_pos_x->pitch, nb_pos_x->yaw) >> 2) & 1) << 5);
         // unsigned int neighbors =
         //     ((block->nb_neg_z && block->nb_neg_z->logic) << 0) |
         //     ((block->nb_neg_y && block->nb_neg_y->logic) << 1) |
@@ -311,14 +362,29 @@ void updateLogicModel(Block *block) {
     }
 }
 
-static void updateChunkLogic(Chunk *chunk, Block ***logicBlocks, int *count, int *max_count) {
+// a logic block, along with where to find its neighbors
+typedef struct LogicRef_S {
+    Chunk *chunk;
+    unsigned int index;
+} LogicRef;
+
+static void updateChunkLogic(Chunk *chunk, LogicRef **logicBlocks, int *count, int *max_count) {
     int i, type, input, output;
-    Block *block;
+    BlockExtra *block;
+    LogicRef *ref;
+    Model *model;
+    mat4 *rotation;
+
+    // don't bother looping if there aren't any blocks. They're counted again once
+    // the chunk is locked, since the main thread may have taken them away
+    if (chunkHasLogic(chunk)) {
+        lockChunk(chunk);
 
-    // don't bother looping if there aren't any blocks.
-    if (chunk->mesh->size) {
-        for (i = 0; i < BLOCKS_PER_CHUNK; i++) {
-            block = &chunk->blocks_lin[i];
+        for (i = 0; chunkHasLogic(chunk) && i < BLOCKS_PER_CHUNK; i++) {
+            if (!(chunk->logic_rows[blockRow(i)] & blockBit(i)))
+                continue;
+
+            block = &chunk->extra[i];
 
             // calculate logic
             if (block->logic) {
@@ -326,10 +392,12 @@ static void updateChunkLogic(Chunk *chunk, Block ***logicBlocks, int *count, int
                 // we only allocate as much space as we need.
                 if (*count >= *max_count) {
                     *max_count = *count + BLOCKS_PER_CHUNK;
-                    *logicBlocks = realloc(*logicBlocks, *max_count * sizeof(Block*));
+                    *logicBlocks = realloc(*logicBlocks, *max_count * sizeof(LogicRef));
                 }
 
-                (*logicBlocks)[(*count)++] = block;
+                ref = &(*logicBlocks)[(*count)++];
+                ref->chunk = chunk;
+                ref->index = i;
 
                 type = block->logic->type & 0xF;
 
@@ -337,12 +405,19 @@ static void updateChunkLogic(Chunk *chunk, Block ***logicBlocks, int *count, int
                 output = rotate_outputs(outputs[type][input], block->logic->roll, block->logic->pitch, block->logic->yaw);
 
                 block->logic->output.all = output;
-                if (showLogic || type == 13) {
-                    if (block->data != (block->data = logic_models[type][input]))
-                        chunk->needsUpdate = 1;
-                }
-                if (block->logic->rotationMatrix != (block->logic->rotationMatrix = &rotation_matrices[block->logic->roll][block->logic->pitch][block->logic->yaw])) {
-                    chunk->needsUpdate = 1;
+
+                model = (showLogic || type == 13) ? logic_models[type][input] : block->data;
+                rotation = &rotation_matrices[block->logic->roll][block->logic->pitch][block->logic->yaw];
+
+                // the mesher reads these without locking, so changing them bumps the version.
+                // Only the instances are built again, since the chunk's mesh has no models
+                if (block->data != model || block->logic->rotationMatrix != rotation) {
+                    beginChunkChange(chunk);
+                    block->data = model;
+                    block->logic->rotationMatrix = rotation;
+                    endChunkChange(chunk);
+
+                    chunk->instancesNeedUpdate = 1;
                 }
             }
             // else if (block->data) {
@@ -376,55 +451,128 @@ static void updateChunkLogic(Chunk *chunk, Block ***logicBlocks, int *count, int
             //         chunk->needsUpdate = 1;
             // }
         }
+
+        unlockChunk(chunk);
     }
 }
 
-void logicLoop(World *world) {
+// copies the logic block next to (x, y, z) into nb, returning 0 if there isn't one.
+// The neighbor may be in a chunk the main thread is changing, so it's read again
+// until the chunk's version holds still. Logic blocks and the arrays pointing at
+// them come from pools, so even a stale read only touches memory that's still ours
+static int readNeighborLogic(World *world, Chunk *chunk, int x, int y, int z, int dx, int dy, int dz, Logic *nb) {
+    unsigned int version;
+    BlockExtra *extra;
+    Logic *logic;
+
+    x += dx; y += dy; z += dz;
+
+    chunk = getNeighborChunk(world, chunk, &x, &y, &z);
+
+    if (!chunk)
+        return 0;
+
+    do {
+        version = beginChunkRead(chunk);
+
+        extra = __atomic_load_n(&chunk->extra, __ATOMIC_RELAXED);
+        logic = extra ? __atomic_load_n(&extra[blockIndex(x, y, z)].logic, __ATOMIC_RELAXED) : NULL;
+
+        if (logic)
+            *nb = *logic;
+    } while (chunkChanged(chunk, version));
+
+    return logic != NULL;
+}
+
+// every logic block works out its outputs, and then reads its inputs from its neighbors
+static void updateLogic(World *world, LogicRef **logicBlocks, int *max_count) {
     unsigned int i;
-    Block *block;
+    Logic *logic, nb;
+    LogicRef *ref;
+    Chunk *locked = NULL;
+    int x, y, z;
 
-    unsigned int num_chunks = world->size * world->size * world->size;
+    unsigned int num_chunks;
+    Chunk **chunks;
     // unsigned int num_blocks = num_chunks * BLOCKS_PER_CHUNK;
 
-    int count;
-    int max_count = BLOCKS_PER_CHUNK;
-    Block **logicBlocks = malloc(max_count * sizeof(Block*));
+    int count = 0;
 
-    while (!quitThread) {
-        // usleep(1000);
+    // the main thread may add chunks, so take the count before the array. The
+    // array it replaces the old one with is stored before the count goes up
+    num_chunks = __atomic_load_n(&world->num_chunks, __ATOMIC_ACQUIRE);
+    chunks = __atomic_load_n(&world->chunks, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < num_chunks; i++) {
+        updateChunkLogic(chunks[i], logicBlocks, &count, max_count);
+    }
+
+    // advance logic (send updated outputs)
+    for (i = 0; i < count; i++) {
+        ref = &(*logicBlocks)[i];
 
-        count = 0;
+        // the blocks of a chunk are next to each other, so each chunk is only locked once
+        if (ref->chunk != locked) {
+            if (locked)
+                unlockChunk(locked);
 
-        for (i = 0; i < num_chunks; i++) {
-            updateChunkLogic(world->chunks[i], &logicBlocks, &count, &max_count);
+            lockChunk(locked = ref->chunk);
         }
 
-        // advance logic (send updated outputs)
-        for (i = 0; i < count; i++) {
-            block = logicBlocks[i];
+        // the main thread may have taken the block away since its outputs were worked out
+        logic = ref->chunk->extra ? ref->chunk->extra[ref->index].logic : NULL;
 
-            if (block->logic) {
-                block->logic->input.pos_x = (block->nb_pos_x && block->nb_pos_x->logic && block->nb_pos_x->logic->output.neg_x);
-                block->logic->input.neg_x = (block->nb_neg_x && block->nb_neg_x->logic && block->nb_neg_x->logic->output.pos_x);
-                block->logic->input.pos_y = (block->nb_pos_y && block->nb_pos_y->logic && block->nb_pos_y->logic->output.neg_y);
-                block->logic->input.neg_y = (block->nb_neg_y && block->nb_neg_y->logic && block->nb_neg_y->logic->output.pos_y);
-                block->logic->input.pos_z = (block->nb_pos_z && block->nb_pos_z->logic && block->nb_pos_z->logic->output.neg_z);
-                block->logic->input.neg_z = (block->nb_neg_z && block->nb_neg_z->logic && block->nb_neg_z->logic->output.pos_z);
-            }
+        if (logic) {
+            x = blockIndexX(ref->index);
+            y = blockIndexY(ref->index);
+            z = blockIndexZ(ref->index);
+
+            logic->input.pos_x = readNeighborLogic(world, ref->chunk, x, y, z,  1,  0,  0, &nb) && nb.output.neg_x;
+            logic->input.neg_x = readNeighborLogic(world, ref->chunk, x, y, z, -1,  0,  0, &nb) && nb.output.pos_x;
+            logic->input.pos_y = readNeighborLogic(world, ref->chunk, x, y, z,  0,  1,  0, &nb) && nb.output.neg_y;
+            logic->input.neg_y = readNeighborLogic(world, ref->chunk, x, y, z,  0, -1,  0, &nb) && nb.output.pos_y;
+            logic->input.pos_z = readNeighborLogic(world, ref->chunk, x, y, z,  0,  0,  1, &nb) && nb.output.neg_z;
+            logic->input.neg_z = readNeighborLogic(world, ref->chunk, x, y, z,  0,  0, -1, &nb) && nb.output.pos_z;
         }
     }
 
+    if (locked)
+        unlockChunk(locked);
+}
+
+void logicLoop(World *world) {
+    int max_count = BLOCKS_PER_CHUNK;
+    LogicRef *logicBlocks = malloc(max_count * sizeof(LogicRef));
+
+    while (!__atomic_load_n(&quitThread, __ATOMIC_ACQUIRE)) {
+        // usleep(1000);
+
+        updateLogic(world, &logicBlocks, &max_count);
+    }
+
+    free(logicBlocks);
+}
+
+// runs the logic on the calling thread, which must not be done while the logic thread is running
+void runLogicSteps(World *world, int steps) {
+    int max_count = BLOCKS_PER_CHUNK;
+    LogicRef *logicBlocks = malloc(max_count * sizeof(LogicRef));
+
+    while (steps--)
+        updateLogic(world, &logicBlocks, &max_count);
+
     free(logicBlocks);
 }
 
 void runLogicThread(World *world) {
-    quitThread = 0;
+    __atomic_store_n(&quitThread, 0, __ATOMIC_RELEASE);
 
     pthread_create(&thread, NULL, (void *(*)(void *))logicLoop, world);
 }
 
 void stopLogicThread() {
-    quitThread = 1;
+    __atomic_store_n(&quitThread, 1, __ATOMIC_RELEASE);
 
     pthread_join(thread, NULL);
 }
@@ -28,16 +28,24 @@ typedef struct Logic_S {
 
 Logic *createLogic();
 void freeLogic(Logic *logic);
-void initLogicBlock(Block *block, int orient, int type, int roll, int pitch, int yaw);
+void initLogicBlock(Block *block, int type, int roll, int pitch, int yaw);
 
 Model *getLogicModel(int type, int inputs);
+mat4 *getRotationMatrix(int index);
+
+// which of the turns the logic block is turned by, or 0 for blocks that aren't logic
+static inline int logicRotation(Logic *logic) {
+    return logic ? logic->rotationMatrix - getRotationMatrix(0) : 0;
+}
+int logicModelSize(int type);
 void updateLogicModel(Block *block);
-void autoOrient(Block *block);
+void autoOrient(Block *block, World *world, Chunk *chunk, int x, int y, int z);
 
 void initLogicModels();
 void freeLogicModels();
 
 void runLogicThread(World *world);
 void stopLogicThread();
+void runLogicSteps(World *world, int steps);
 
 #endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <math.h>
 #include <time.h>
 #include <pthread.h>
@@ -11,11 +12,15 @@
 #include "light.h"
 #include "string.h"
 #include "logic.h"
+#include "meshing.h"
 
 #define SCREEN_WIDTH 1280
 #define SCREEN_HEIGHT 800
 #define MOUSE_SPEED 0.1
 #define MAX_LIGHTS 10
+// in chunks, so that the same area is loaded whatever the chunk size
+#define STREAM_RADIUS (256 / CHUNK_SIZE)
+#define SELECT_RADIUS 16
 
 extern GLuint loadShaders(const char * vertex_file_path, const char * fragment_file_path);
 extern GLuint loadTextureBMP(const char * texture_file_path);
@@ -29,7 +34,8 @@ typedef enum ProgramType_E {
     SHADOW_PROGRAM,
     PLAIN_PROGRAM,
     TEXTURE_PROGRAM,
-    SKYBOX_PROGRAM
+    SKYBOX_PROGRAM,
+    INSTANCE_PROGRAM
 } ProgramType;
 
 static void windowResizeFunc(GLFWwindow* window, int width, int height);
@@ -64,7 +70,7 @@ static mat4 identityMatrix = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
 
 static ProgramType currProgram;
 
-static GLuint normalProgram, /*shadowProgram,*/ plainProgram, textureProgram, skyboxProgram;
+static GLuint normalProgram, /*shadowProgram,*/ plainProgram, textureProgram, skyboxProgram, instanceProgram;
 static GLuint vao;
 static GLuint /*normalLightUBO,*/ normalMaterialsUBO;
 static GLuint normalModelUniformID, normalViewUniformID,
@@ -82,7 +88,10 @@ static GLuint normalModelUniformID, normalViewUniformID,
               textureProjectionUniformID, textureTextureUniformID,
 
               skyboxModelUniformID, skyboxViewUniformID,
-              skyboxProjectionUniformID, skyboxSkyboxUniformID;
+              skyboxProjectionUniformID, skyboxSkyboxUniformID,
+
+              instanceModelUniformID, instanceViewUniformID,
+              instanceProjectionUniformID;
 
 static mat4 viewMatrix;
 static mat4 projectionMatrix;
@@ -144,13 +153,14 @@ static void keyCallback(GLFWwindow* window, int key, int scancode, int action, i
             break;
         case GLFW_KEY_1:
             if (action == GLFW_RELEASE) {
-                Chunk *chunk = getChunk(world, (int)(player->position[0] / BLOCK_WIDTH) >> LOG_CHUNK_SIZE,
+                Chunk *chunk = addChunk(world, (int)(player->position[0] / BLOCK_WIDTH) >> LOG_CHUNK_SIZE,
                                             (int)(player->position[1] / BLOCK_WIDTH) >> LOG_CHUNK_SIZE,
                                             (int)(player->position[2] / BLOCK_WIDTH) >> LOG_CHUNK_SIZE);
                 char* name = malloc(40);
                 sprintf(name, "models/model%ld", time(NULL));
                 writeModel(chunk, name);
                 puts("Saved model");
+                releaseModel(model1);
                 model1 = createModel();
                 readModel(model1, name);
                 free(name);
@@ -164,7 +174,7 @@ static void keyCallback(GLFWwindow* window, int key, int scancode, int action, i
             break;
         case GLFW_KEY_3:
             if (action == GLFW_RELEASE) {
-                copyChunk(getChunk(world, (int)(player->position[0] / BLOCK_WIDTH) >> LOG_CHUNK_SIZE,
+                copyChunk(addChunk(world, (int)(player->position[0] / BLOCK_WIDTH) >> LOG_CHUNK_SIZE,
                                           (int)(player->position[1] / BLOCK_WIDTH) >> LOG_CHUNK_SIZE,
                                           (int)(player->position[2] / BLOCK_WIDTH) >> LOG_CHUNK_SIZE),
                           model1->chunk);
@@ -172,19 +182,21 @@ static void keyCallback(GLFWwindow* window, int key, int scancode, int action, i
             break;
         case GLFW_KEY_E:
             if (action == GLFW_PRESS && selection.selected_active) {
-                Block* selected = selectedBlock(world, &selection);
-                currColor = selected->color;
-                if (selected->logic) {
-                    selectedType = selected->logic->type + 1;
-                    s_roll = selected->logic->roll;
-                    s_pitch = selected->logic->pitch;
-                    s_yaw = selected->logic->yaw;
+                Block selected = selectedBlock(world, &selection);
+                currColor = selected.color;
+                if (selected.logic) {
+                    selectedType = selected.logic->type + 1;
+                    s_roll = selected.logic->roll;
+                    s_pitch = selected.logic->pitch;
+                    s_yaw = selected.logic->yaw;
                 } else {
                     selectedType = s_roll = s_pitch = s_yaw = 0;
                 }
 
-                if (selected->data) {
-                    model1 = selected->data;
+                if (selected.data) {
+                    shareModel(selected.data);
+                    releaseModel(model1);
+                    model1 = selected.data;
                 }
 
                 updateColorRect();
@@ -201,42 +213,48 @@ static void keyCallback(GLFWwindow* window, int key, int scancode, int action, i
             break;
         case GLFW_KEY_EQUAL:
             if (action == GLFW_PRESS) {
-                useMeshing = !useMeshing;
                 int i;
+
+                useMeshing = !useMeshing;
                 renderModel(model1);
+
                 for (i = 0; i < world->num_chunks; i++) {
-                    renderChunk(world->chunks[i]);
+                    queueChunkMesh(world->chunks[i]);
                 }
             }
             break;
         case GLFW_KEY_L:
             if (action == GLFW_PRESS && selection.selected_active) {
-                Block* selected = selectedBlock(world, &selection);
-                Chunk *chunk = getChunk(world, selection.previous_chunk_x, selection.previous_chunk_y, selection.previous_chunk_z);
-                if (selected->logic) {
-                    selected->logic->type++;
-                    selected->logic->type %= NUM_GATES;
-                    if (selected->logic->auto_orient)
-                        autoOrient(selected);
+                Block selected = selectedBlock(world, &selection);
+                if (selected.logic) {
+                    selected.logic->type++;
+                    selected.logic->type %= NUM_GATES;
                 } else {
-                    initLogicBlock(selected, 1, 0, 0, 0, 0);
+                    initLogicBlock(&selected, 0, 0, 0, 0);
                 }
-                renderChunk(chunk);
+                if (selected.logic->auto_orient)
+                    autoOrient(&selected, world, selectedChunk(world, &selection),
+                               selection.selected_block_x, selection.selected_block_y, selection.selected_block_z);
+                updateLogicModel(&selected);
+                setBlock(selectedChunk(world, &selection),
+                         selection.selected_block_x, selection.selected_block_y, selection.selected_block_z, selected);
             }
             break;
         case GLFW_KEY_K:
             if (action == GLFW_PRESS && selection.selected_active) {
-                Block* selected = selectedBlock(world, &selection);
-                Chunk *chunk = getChunk(world, selection.previous_chunk_x, selection.previous_chunk_y, selection.previous_chunk_z);
-                if (selected->logic) {
-                    selected->logic->type += (NUM_GATES-1);
-                    selected->logic->type %= NUM_GATES;
-                    if (selected->logic->auto_orient)
-                        autoOrient(selected);
+                Block selected = selectedBlock(world, &selection);
+                if (selected.logic) {
+                    selected.logic->type += (NUM_GATES-1);
+                    selected.logic->type %= NUM_GATES;
                 } else {
-                    initLogicBlock(selected, 1, NUM_GATES-1, 0, 0, 0);
+                    initLogicBlock(&selected, NUM_GATES-1, 0, 0, 0);
                 }
-                renderChunk(chunk);
+                if (selected.logic->auto_orient)
+                    autoOrient(&selected, world, selectedChunk(world, &selection),
+                               selection.selected_block_x, selection.selected_block_y, selection.selected_block_z);
+                updateLogicModel(&selected);
+                setBlock(selectedChunk(world, &selection),
+                         selection.selected_block_x, selection.selected_block_y, selection.selected_block_z, selected);
             }
             break;
         case GLFW_KEY_SEMICOLON:
@@ -245,28 +263,28 @@ static void keyCallback(GLFWwindow* window, int key, int scancode, int action, i
             break;
         case GLFW_KEY_I:
             if (action == GLFW_PRESS && selection.selected_active) {
-                Block* selected = selectedBlock(world, &selection);
-                if (selected->logic) {
-                    selected->logic->roll++;
-                    selected->logic->auto_orient = 0;
+                Block selected = selectedBlock(world, &selection);
+                if (selected.logic) {
+                    selected.logic->roll++;
+                    selected.logic->auto_orient = 0;
                 }
             }
             break;
         case GLFW_KEY_O:
             if (action == GLFW_PRESS && selection.selected_active) {
-                Block* selected = selectedBlock(world, &selection);
-                if (selected->logic) {
-                    selected->logic->yaw++;
-                    selected->logic->auto_orient = 0;
+                Block selected = selectedBlock(world, &selection);
+                if (selected.logic) {
+                    selected.logic->yaw++;
+                    selected.logic->auto_orient = 0;
                 }
             }
             break;
         case GLFW_KEY_P:
             if (action == GLFW_PRESS && selection.selected_active) {
-                Block* selected = selectedBlock(world, &selection);
-                if (selected->logic) {
-                    selected->logic->pitch++;
-                    selected->logic->auto_orient = 0;
+                Block selected = selectedBlock(world, &selection);
+                if (selected.logic) {
+                    selected.logic->pitch++;
+                    selected.logic->auto_orient = 0;
                 }
             }
             break;
@@ -341,15 +359,19 @@ static void readInputs(GLFWwindow* window) {
         if (newMouseButtons[1] && !mouseButtons[1])
             if (selection.previous_active) {
                 Block block = (Block){1, currColor, NULL, NULL};
+                Chunk *chunk = addChunk(world, selection.previous_chunk_x, selection.previous_chunk_y, selection.previous_chunk_z);
 
                 if (selectedType) {
-                    initLogicBlock(&block, !(s_roll | s_pitch | s_yaw), selectedType - 1, s_roll, s_pitch, s_yaw);
+                    initLogicBlock(&block, selectedType - 1, s_roll, s_pitch, s_yaw);
+                    if (!(s_roll | s_pitch | s_yaw)) {
+                        autoOrient(&block, world, chunk, selection.previous_block_x, selection.previous_block_y, selection.previous_block_z);
+                        updateLogicModel(&block);
+                    }
                 } else if (placeModel) {
                     insertModel(model1, &block);
                 }
 
-                setBlock(getChunk(world, selection.previous_chunk_x, selection.previous_chunk_y, selection.previous_chunk_z),
-                         selection.previous_block_x, selection.previous_block_y, selection.previous_block_z, block);
+                setBlock(chunk, selection.previous_block_x, selection.previous_block_y, selection.previous_block_z, block);
             }
 
         // mouse position
@@ -415,12 +437,12 @@ static void initMeshes() {
     }
 
     for (int i=1; i <= NUM_GATES; i++) {
-        translate_m4(blockTypes[i]->modelMatrix, -CHUNK_WIDTH/2, -CHUNK_WIDTH/2, -CHUNK_WIDTH/2);
+        translate_m4(blockTypes[i]->modelMatrix, -MODEL_WIDTH/2, -MODEL_WIDTH/2, -MODEL_WIDTH/2);
         rotate_X_m4(blockTypes[i]->modelMatrix, 1.5707963268);
-        translate_m4(blockTypes[i]->modelMatrix, CHUNK_WIDTH/2, CHUNK_WIDTH/2, CHUNK_WIDTH/2);
+        translate_m4(blockTypes[i]->modelMatrix, MODEL_WIDTH/2, MODEL_WIDTH/2, MODEL_WIDTH/2);
 
-        float sx = PIXEL_X(100) / CHUNK_WIDTH;
-        float sy = PIXEL_Y(100) / CHUNK_WIDTH;
+        float sx = PIXEL_X(100) / MODEL_WIDTH;
+        float sy = PIXEL_Y(100) / MODEL_WIDTH;
         multiply_m4(blockTypes[i]->modelMatrix, (mat4){sx, 0, 0, 0, 0, sy, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1});
         translate_m4(blockTypes[i]->modelMatrix, PIXEL_X(-frame_buffer_width / 2 + 20), PIXEL_Y(-frame_buffer_height / 2 + 20), 0);
     }
@@ -466,6 +488,9 @@ static void useProgram(ProgramType prog) {
         case SKYBOX_PROGRAM:
             glUseProgram(skyboxProgram);
             break;
+        case INSTANCE_PROGRAM:
+            glUseProgram(instanceProgram);
+            break;
         default:
             break;
     }
@@ -488,6 +513,9 @@ static void sendProjectionMatrix(mat4 data) {
         case SKYBOX_PROGRAM:
             glUniformMatrix4fv(skyboxProjectionUniformID, 1, GL_TRUE, data);
             break;
+        case INSTANCE_PROGRAM:
+            glUniformMatrix4fv(instanceProjectionUniformID, 1, GL_TRUE, data);
+            break;
         default:
             break;
     }
@@ -510,6 +538,9 @@ static void sendViewMatrix(mat4 data) {
         case SKYBOX_PROGRAM:
             glUniformMatrix4fv(skyboxViewUniformID, 1, GL_TRUE, data);
             break;
+        case INSTANCE_PROGRAM:
+            glUniformMatrix4fv(instanceViewUniformID, 1, GL_TRUE, data);
+            break;
         default:
             break;
     }
@@ -532,6 +563,9 @@ static void sendModelMatrix(mat4 data) {
         case SKYBOX_PROGRAM:
             glUniformMatrix4fv(skyboxModelUniformID, 1, GL_TRUE, data);
             break;
+        case INSTANCE_PROGRAM:
+            glUniformMatrix4fv(instanceModelUniformID, 1, GL_TRUE, data);
+            break;
         default:
             break;
     }
@@ -571,6 +605,25 @@ void drawMesh(Mesh * mesh) {
 
     sendModelMatrix(mesh->modelMatrix);
 
+    // a packed mesh has everything in one buffer, with the position and normal read
+    // together as integers and the color as bytes scaled down to [0, 1]
+    if (mesh->packed) {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexvbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribIPointer(0, 4, GL_UNSIGNED_SHORT, sizeof(PackedVertex),
+                               (void*)offsetof(PackedVertex, position));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedVertex),
+                              (void*)offsetof(PackedVertex, color));
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->buffer);
+        glDrawElements(mesh->type, mesh->size, GL_UNSIGNED_INT, NULL);
+
+        glDisableVertexAttribArray(0);
+        glDisableVertexAttribArray(2);
+        return;
+    }
+
     glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexvbo);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
@@ -602,6 +655,43 @@ void drawMesh(Mesh * mesh) {
     glDisableVertexAttribArray(3);
 }
 
+// draws count copies of the mesh, each placed and turned by one of the instances
+// from first on. The instances are read as bytes: the block and the turn
+void drawInstances(Mesh *mesh, mat4 modelMatrix, GLuint instances, int first, int count) {
+    if (mesh->size == 0 || count == 0)
+        return;
+
+    sendModelMatrix(modelMatrix);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexvbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->normalvbo);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->colorvbo);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+    glBindBuffer(GL_ARRAY_BUFFER, instances);
+    glEnableVertexAttribArray(4);
+    glVertexAttribIPointer(4, 4, GL_UNSIGNED_BYTE, sizeof(ModelInstance),
+                           (void*)(first * sizeof(ModelInstance)));
+    glVertexAttribDivisor(4, 1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->buffer);
+    glDrawElementsInstanced(mesh->type, mesh->size, GL_UNSIGNED_INT, NULL, count);
+
+    glVertexAttribDivisor(4, 0);
+
+    glDisableVertexAttribArray(0);
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(2);
+    glDisableVertexAttribArray(4);
+}
+
 void init(GLFWwindow *window) {
     control = 1;
     wireframe = 0;
@@ -631,25 +721,10 @@ void init(GLFWwindow *window) {
     plainProgram   = loadShaders("shaders/plainShader.vert", "shaders/plainShader.frag");
     textureProgram = loadShaders("shaders/textureShader.vert", "shaders/textureShader.frag");
     skyboxProgram  = loadShaders("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
+    instanceProgram = loadShaders("shaders/instanceShader.vert", "shaders/normalShader.frag");
 
     useProgram(NORMAL_PROGRAM);
 
-    /* benchmark */
-
-    #if 0
-    useMeshing = 1;
-    float before = glfwGetTime();
-    int i, j;
-    for (i = 0; i < 100; i++) {
-        for (j = 0; j < world->num_chunks; j++) {
-            renderChunk(world->chunks[j]);
-        }
-    }
-    float delta = glfwGetTime() - before;
-    printf("Benchmark took %.2f seconds\n", delta);
-    useMeshing = 0;
-    #endif
-
     /* meshes, etc. */
 
     initLogicModels();
@@ -657,7 +732,9 @@ void init(GLFWwindow *window) {
     // world = createWorld(6);
     // fillWorld(world);
 
-    world = readWorld("worlds/saved");
+    // chunks are loaded as the player gets near them
+    world = openWorld("worlds/saved", STREAM_RADIUS);
+    // world = readWorld("worlds/saved");
     // world = readWorld("worlds/gates_updated");
 
     player = createPlayer(world);
@@ -693,6 +770,7 @@ void init(GLFWwindow *window) {
     glBindBuffer(GL_UNIFORM_BUFFER, normalMaterialsUBO);
     glBufferData(GL_UNIFORM_BUFFER, sizeof(GLfloat) * 12, NULL, GL_STATIC_DRAW);
     glUniformBlockBinding(normalProgram, glGetUniformBlockIndex(normalProgram, "Materials"), 1);
+    glUniformBlockBinding(instanceProgram, glGetUniformBlockIndex(instanceProgram, "Materials"), 1);
     glBindBufferBase(GL_UNIFORM_BUFFER, 1, normalMaterialsUBO);
     glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(GLfloat) * 12, (GLfloat[]) {
         0.3, 0.3, 0.3, 0, // diffuse
@@ -728,6 +806,25 @@ void init(GLFWwindow *window) {
     skyboxProjectionUniformID = glGetUniformLocation(skyboxProgram, "projectionMatrix");
     skyboxSkyboxUniformID     = glGetUniformLocation(skyboxProgram, "skybox");
 
+    instanceModelUniformID      = glGetUniformLocation(instanceProgram, "modelMatrix");
+    instanceViewUniformID       = glGetUniformLocation(instanceProgram, "viewMatrix");
+    instanceProjectionUniformID = glGetUniformLocation(instanceProgram, "projectionMatrix");
+
+    // the turns of the logic blocks never change, so they're only sent once
+    {
+        GLfloat rotations[64 * 9];
+        int i, j;
+
+        for (i = 0; i < 64; i++)
+            for (j = 0; j < 9; j++)
+                rotations[i * 9 + j] = (*getRotationMatrix(i))[(j / 3) * 4 + j % 3];
+
+        useProgram(INSTANCE_PROGRAM);
+        glUniformMatrix3fv(glGetUniformLocation(instanceProgram, "rotations"), 64, GL_TRUE, rotations);
+        glUniform1f(glGetUniformLocation(instanceProgram, "modelWidth"), MODEL_WIDTH);
+        useProgram(NORMAL_PROGRAM);
+    }
+
     /* view options */
 
     perspective(projectionMatrix, (float)frame_buffer_width/frame_buffer_height, 60, 0.01, 100);
@@ -750,6 +847,7 @@ void init(GLFWwindow *window) {
 
     glViewport(0, 0, frame_buffer_width, frame_buffer_height);
 
+    startMeshing();
     runLogicThread(world);
 }
 
@@ -773,19 +871,36 @@ void tick(GLFWwindow *window) {
 
     readInputs(window);
 
+    // the logic thread looks chunks up, so it can't run while they're unloaded
+    if (streamMoved(world, player->position)) {
+        stopLogicThread();
+        streamWorld(world, player->position);
+        freeUnloadedChunks(world);
+        runLogicThread(world);
+    } else {
+        streamWorld(world, player->position);
+    }
+
     vec3 pos;
     copy_v3(pos, player->position);
     scale_v3(pos, 1.0f/BLOCK_WIDTH);
 
-    selection = selectBlock(world, pos, player->direction, CHUNK_SIZE);
+    selection = selectBlock(world, pos, player->direction, SELECT_RADIUS);
 
+    // chunks are meshed on the mesh threads, and only uploaded here
     for (int i = 0; i < world->num_chunks; i++) {
         if (world->chunks[i]->needsUpdate) {
             world->chunks[i]->needsUpdate = 0;
-            renderChunk(world->chunks[i]);
+            queueChunkMesh(world->chunks[i]);
         }
+
+        // models that were swapped, by the logic thread say, aren't in the mesh
+        if (world->chunks[i]->instancesNeedUpdate)
+            updateChunkInstances(world->chunks[i]);
     }
 
+    applyChunkMeshes();
+
     render();
 }
 
@@ -884,6 +999,14 @@ void render() {
 
         renderWorld(viewMatrix, projectionMatrix);
 
+    // draw the models in the world
+    useProgram(INSTANCE_PROGRAM);
+
+        sendViewMatrix(viewMatrix);
+        sendProjectionMatrix(projectionMatrix);
+
+        drawWorldModels(world, viewMatrix, projectionMatrix);
+
     // draw GUI, etc.
     useProgram(PLAIN_PROGRAM);
 
@@ -930,6 +1053,7 @@ void render() {
 
 void finish() {
     stopLogicThread();
+    stopMeshing();
     freeLogicModels();
 
     // int i;
@@ -9,6 +9,7 @@
 #include "voxels.h"
 
 void drawMesh(Mesh * mesh);
+void drawInstances(Mesh *mesh, mat4 modelMatrix, GLuint instances, int first, int count);
 
 void init(GLFWwindow *window);
 void tick(GLFWwindow *window);
@@ -4,6 +4,14 @@
 
 #include "matrix.h"
 
+// SSE is always there on x86-64, AVX is checked for when the program runs
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SIMD_TRANSFORMS
+#endif
+
+typedef void (*TransformKernel)(GLfloat *dest, const GLfloat *src, int count, const mat4 m, const float w);
+
 void translate_v3f(vec3 vec, const float x, const float y, const float z) {
     vec[0] += x;
     vec[1] += y;
@@ -115,6 +123,132 @@ void multiply_v4_m4(vec4 v, const mat4 m) {
     copy_v4(v, n);
 }
 
+static void multiply_v3_array_m4_scalar(GLfloat *dest, const GLfloat *src, int count, const mat4 m, const float w) {
+    int i;
+
+    for (i = 0; i < count * 3; i += 3) {
+        copy_v3(&dest[i], &src[i]);
+        multiply_v3_m4(&dest[i], m, w);
+    }
+}
+
+#ifdef SIMD_TRANSFORMS
+
+// the vectors are xyz triples one after another. A group of 4 is shuffled into
+// a register of x's, one of y's and one of z's, transformed, and shuffled back.
+// The sums are added up in the same order as multiply_v3_m4, so the results match
+#define AOS_TO_SOA(type, mm, a, b, c, x, y, z) { \
+    type xy_ = mm##_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2)); \
+    type yz_ = mm##_shuffle_ps(a, b, _MM_SHUFFLE(1, 0, 2, 1)); \
+    x = mm##_shuffle_ps(a, xy_, _MM_SHUFFLE(2, 0, 3, 0)); \
+    y = mm##_shuffle_ps(yz_, xy_, _MM_SHUFFLE(3, 1, 2, 0)); \
+    z = mm##_shuffle_ps(yz_, c, _MM_SHUFFLE(3, 0, 3, 1)); \
+}
+
+#define SOA_TO_AOS(type, mm, x, y, z, a, b, c) { \
+    type xy_ = mm##_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0)); \
+    type yz_ = mm##_shuffle_ps(y, z, _MM_SHUFFLE(3, 1, 3, 1)); \
+    type zx_ = mm##_shuffle_ps(z, x, _MM_SHUFFLE(3, 1, 2, 0)); \
+    a = mm##_shuffle_ps(xy_, zx_, _MM_SHUFFLE(2, 0, 2, 0)); \
+    b = mm##_shuffle_ps(yz_, xy_, _MM_SHUFFLE(3, 1, 2, 0)); \
+    c = mm##_shuffle_ps(zx_, yz_, _MM_SHUFFLE(3, 1, 3, 1)); \
+}
+
+// one row of the matrix times the vectors
+#define TRANSFORM_ROW(mm, x, y, z, m, row, w) \
+    mm##_add_ps(mm##_add_ps(mm##_add_ps( \
+        mm##_mul_ps(x, mm##_set1_ps(m[row * 4 + 0])), \
+        mm##_mul_ps(y, mm##_set1_ps(m[row * 4 + 1]))), \
+        mm##_mul_ps(z, mm##_set1_ps(m[row * 4 + 2]))), \
+        mm##_set1_ps(w * m[row * 4 + 3]))
+
+static void multiply_v3_array_m4_sse(GLfloat *dest, const GLfloat *src, int count, const mat4 m, const float w) {
+    __m128 a, b, c, x, y, z, nx, ny, nz;
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4, src += 12, dest += 12) {
+        a = _mm_loadu_ps(src);
+        b = _mm_loadu_ps(src + 4);
+        c = _mm_loadu_ps(src + 8);
+        AOS_TO_SOA(__m128, _mm, a, b, c, x, y, z);
+
+        nx = TRANSFORM_ROW(_mm, x, y, z, m, 0, w);
+        ny = TRANSFORM_ROW(_mm, x, y, z, m, 1, w);
+        nz = TRANSFORM_ROW(_mm, x, y, z, m, 2, w);
+
+        SOA_TO_AOS(__m128, _mm, nx, ny, nz, a, b, c);
+        _mm_storeu_ps(dest, a);
+        _mm_storeu_ps(dest + 4, b);
+        _mm_storeu_ps(dest + 8, c);
+    }
+
+    multiply_v3_array_m4_scalar(dest, src, count - i, m, w);
+}
+
+// the same, 8 at a time. Each half of the registers holds a group of 4
+__attribute__((target("avx")))
+static void multiply_v3_array_m4_avx(GLfloat *dest, const GLfloat *src, int count, const mat4 m, const float w) {
+    __m256 a, b, c, x, y, z, nx, ny, nz;
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8, src += 24, dest += 24) {
+        a = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(src)), _mm_loadu_ps(src + 12), 1);
+        b = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(src + 4)), _mm_loadu_ps(src + 16), 1);
+        c = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(src + 8)), _mm_loadu_ps(src + 20), 1);
+        AOS_TO_SOA(__m256, _mm256, a, b, c, x, y, z);
+
+        nx = TRANSFORM_ROW(_mm256, x, y, z, m, 0, w);
+        ny = TRANSFORM_ROW(_mm256, x, y, z, m, 1, w);
+        nz = TRANSFORM_ROW(_mm256, x, y, z, m, 2, w);
+
+        SOA_TO_AOS(__m256, _mm256, nx, ny, nz, a, b, c);
+        _mm_storeu_ps(dest, _mm256_castps256_ps128(a));
+        _mm_storeu_ps(dest + 4, _mm256_castps256_ps128(b));
+        _mm_storeu_ps(dest + 8, _mm256_castps256_ps128(c));
+        _mm_storeu_ps(dest + 12, _mm256_extractf128_ps(a, 1));
+        _mm_storeu_ps(dest + 16, _mm256_extractf128_ps(b, 1));
+        _mm_storeu_ps(dest + 20, _mm256_extractf128_ps(c, 1));
+    }
+
+    multiply_v3_array_m4_sse(dest, src, count - i, m, w);
+}
+
+#endif
+
+static TransformKernel pickTransformKernel() {
+#ifdef SIMD_TRANSFORMS
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx"))
+        return multiply_v3_array_m4_avx;
+
+    return multiply_v3_array_m4_sse;
+#else
+    return multiply_v3_array_m4_scalar;
+#endif
+}
+
+// multiplies count vectors by the matrix, like multiply_v3_m4 does one. dest may
+// be src. The kernel is picked the first time, so this should first be called
+// before more than one thread can
+void multiply_v3_array_m4(GLfloat *dest, const GLfloat *src, int count, const mat4 m, const float w) {
+    static TransformKernel kernel = NULL;
+
+    if (!kernel)
+        kernel = pickTransformKernel();
+
+    kernel(dest, src, count, m, w);
+}
+
+// the points of a mesh are moved by the whole matrix, and its normals only
+// turned. Either array of normals may be left NULL
+void multiply_vertices_m4(GLfloat *points, GLfloat *normals, const GLfloat *src_points, const GLfloat *src_normals, int count, const mat4 m) {
+    multiply_v3_array_m4(points, src_points, count, m, 1.0);
+
+    if (normals && src_normals)
+        multiply_v3_array_m4(normals, src_normals, count, m, 0.0);
+}
+
 void translate_m4(mat4 m, const float x, const float y, const float z) {
     mat4 n = {
         m[ 0]+x*m[12],     m[ 1]+x*m[13],     m[ 2]+x*m[14],     m[ 3]+x*m[15],
@@ -39,6 +39,8 @@ void zero_v3(vec3 v);
 
 void multiply_v3_m4(vec3 vec, const mat4 mat, const float w);
 void multiply_v4_m4(vec4 v, const mat4 m);
+void multiply_v3_array_m4(GLfloat *dest, const GLfloat *src, int count, const mat4 m, const float w);
+void multiply_vertices_m4(GLfloat *points, GLfloat *normals, const GLfloat *src_points, const GLfloat *src_normals, int count, const mat4 m);
 
 void translate_m4(mat4 mat, const float x, const float y, const float z);
 void rotate_X_m4(mat4 mat, const float radians);
@@ -10,6 +10,47 @@
 extern int frame_buffer_width;
 extern int frame_buffer_height;
 
+// every mesh of quads is drawn with the same indices, which grow to fit the biggest
+static GLuint quadIndices = 0;
+static int maxQuads = 0;
+
+// the shared indices, with room for at least num_quads quads. Quad i is drawn
+// as the triangles (0, 1, 2) and (0, 2, 3) of vertices 4i to 4i + 3
+static GLuint quadIndexBuffer(int num_quads) {
+    GLuint *indices;
+    int i;
+
+    if (num_quads <= maxQuads)
+        return quadIndices;
+
+    if (!quadIndices)
+        glGenBuffers(1, &quadIndices);
+
+    if (!maxQuads)
+        maxQuads = 1024;
+
+    while (maxQuads < num_quads)
+        maxQuads *= 2;
+
+    indices = malloc(maxQuads * 6 * sizeof(GLuint));
+
+    for (i = 0; i < maxQuads; i++) {
+        indices[i * 6 + 0] = i * 4 + 0;
+        indices[i * 6 + 1] = i * 4 + 1;
+        indices[i * 6 + 2] = i * 4 + 2;
+        indices[i * 6 + 3] = i * 4 + 0;
+        indices[i * 6 + 4] = i * 4 + 2;
+        indices[i * 6 + 5] = i * 4 + 3;
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, maxQuads * 6 * sizeof(GLuint), indices, GL_STATIC_DRAW);
+
+    free(indices);
+
+    return quadIndices;
+}
+
 void rect(Mesh *mesh, float minx, float miny, float maxx, float maxy, float z, vec3 color) {
     GLfloat points[] = { BOX_CORNERS(minx, miny, maxx, maxy, z) };
     GLfloat normals[] ={ REP_4(REP_3(0)) };
@@ -118,7 +159,7 @@ void makeColorChooser(Mesh *mesh, int chunksx, int chunksy, int chunkwidth, int
 }
 
 void makeBlockChooser(Mesh *mesh, int height, int padding, int border) {
-    #define NUM_QUADS (NUM_GATES * CHUNK_SIZE * CHUNK_SIZE)
+    #define NUM_QUADS (NUM_GATES * MODEL_SIZE * MODEL_SIZE)
     #define NUM_POINTS (3 * 4 * NUM_QUADS)
     #define NUM_INDICES (3 * 3 * 2 * NUM_QUADS)
 
@@ -276,7 +317,10 @@ void freeMesh(Mesh *mesh) {
     glDeleteBuffers(1, &mesh->normalvbo);
     glDeleteBuffers(1, &mesh->colorvbo);
     glDeleteBuffers(1, &mesh->texvbo);
-    glDeleteBuffers(1, &mesh->buffer);
+
+    // the quad indices are shared by every mesh of quads
+    if (mesh->buffer != quadIndices)
+        glDeleteBuffers(1, &mesh->buffer);
 }
 
 void buildMesh(Mesh *mesh, GLfloat *points, GLfloat *normals, GLfloat *colors, GLfloat *texuvs, GLuint *indices,
@@ -309,3 +353,43 @@ void buildMesh(Mesh *mesh, GLfloat *points, GLfloat *normals, GLfloat *colors, G
     *mesh = (Mesh){GL_TRIANGLES, bufs[0], bufs[1], bufs[2], bufs[3], bufs[4], nindices};
     identity_m4(mesh->modelMatrix);
 }
+
+void buildPackedMesh(Mesh *mesh, PackedVertex *vertices, int nvertices) {
+    GLuint buf;
+
+    glGenBuffers(1, &buf);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buf);
+    glBufferData(GL_ARRAY_BUFFER, nvertices * sizeof(PackedVertex), vertices, GL_STATIC_DRAW);
+
+    *mesh = (Mesh){GL_TRIANGLES, buf, 0, 0, 0, quadIndexBuffer(nvertices / 4), nvertices / 4 * 6};
+    identity_m4(mesh->modelMatrix);
+    mesh->packed = 1;
+}
+
+// per instance data for drawing a mesh many times over. The buffer is made the
+// first time, and filled again after that
+void buildInstanceBuffer(GLuint *buffer, const void *instances, int size) {
+    if (!*buffer)
+        glGenBuffers(1, buffer);
+
+    glBindBuffer(GL_ARRAY_BUFFER, *buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, instances, GL_DYNAMIC_DRAW);
+}
+
+void freeInstanceBuffer(GLuint *buffer) {
+    if (*buffer)
+        glDeleteBuffers(1, buffer);
+
+    *buffer = 0;
+}
+
+// a mesh of quads, 4 vertices each, drawn with the shared quad indices
+void buildQuadMesh(Mesh *mesh, GLfloat *points, GLfloat *normals, GLfloat *colors, int nvertices) {
+    buildMesh(mesh, points, normals, colors, NULL, NULL,
+              nvertices * 3 * sizeof(GLfloat), nvertices * 3 * sizeof(GLfloat),
+              nvertices * 3 * sizeof(GLfloat), 0, 0,
+              nvertices / 4 * 6);
+
+    mesh->buffer = quadIndexBuffer(nvertices / 4);
+}
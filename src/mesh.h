@@ -32,8 +32,20 @@ typedef struct Mesh_S {
     int size;
 
     mat4 modelMatrix;
+
+    // set for meshes built from packed vertices, which are all in vertexvbo
+    char packed;
 } Mesh;
 
+// a vertex of a chunk mesh, in 12 bytes rather than the 36 of three float vectors.
+// The position is in steps that the mesh's model matrix scales up, and the normal
+// is which face of a cube it is: -x, +x, -y, +y, -z, +z. The last color byte is
+// only there to keep the vertices aligned
+typedef struct PackedVertex_S {
+    GLushort position[3], normal;
+    GLubyte color[4];
+} PackedVertex;
+
 void rect(Mesh *mesh, float minx, float miny, float maxx, float maxy, float z, vec3 color);
 
 void makeCrosshair(Mesh *mesh, int width, int height, int border);
@@ -48,5 +60,9 @@ Mesh *createMesh();
 void freeMesh(Mesh *mesh);
 void buildMesh(Mesh *mesh, GLfloat *points, GLfloat *normals, GLfloat *colors, GLfloat *texuvs, GLuint *indices,
                int spoints, int snormals, int scolors, int stexuvs, int sindices, int nindices);
+void buildPackedMesh(Mesh *mesh, PackedVertex *vertices, int nvertices);
+void buildQuadMesh(Mesh *mesh, GLfloat *points, GLfloat *normals, GLfloat *colors, int nvertices);
+void buildInstanceBuffer(GLuint *buffer, const void *instances, int size);
+void freeInstanceBuffer(GLuint *buffer);
 
 #endif
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "meshing.h"
+
+// at most this many threads build meshes, however many cores there are
+#define MAX_MESH_THREADS 8
+
+// a chunk waiting to be meshed, and then to have its mesh uploaded. The mesh
+// threads only ever see the copy, so the chunk itself can go on changing
+typedef struct MeshJob_S {
+    struct MeshJob_S *next;
+
+    // NULL once the chunk has been freed
+    Chunk *chunk;
+    Chunk *copy;
+    unsigned int request;
+
+    PackedVertex *vertices;
+    int num_vertices;
+} MeshJob;
+
+typedef struct MeshQueue_S {
+    MeshJob *first, *last;
+} MeshQueue;
+
+static pthread_t threads[MAX_MESH_THREADS];
+static int num_threads = 0;
+static int quitMeshing = 0;
+
+// everything below is only touched while holding the lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobsReady = PTHREAD_COND_INITIALIZER;
+
+// jobs are taken from todo oldest first, and wait in done until the main thread
+// uploads them. Working holds the job each thread is on
+static MeshQueue todo, done;
+static MeshJob *working[MAX_MESH_THREADS];
+
+static void pushJob(MeshQueue *queue, MeshJob *job) {
+    job->next = NULL;
+
+    if (queue->last)
+        queue->last->next = job;
+    else
+        queue->first = job;
+
+    queue->last = job;
+}
+
+static MeshJob *popJob(MeshQueue *queue) {
+    MeshJob *job = queue->first;
+
+    if (job) {
+        queue->first = job->next;
+
+        if (!queue->first)
+            queue->last = NULL;
+    }
+
+    return job;
+}
+
+static void freeJob(MeshJob *job) {
+    freeChunk(job->copy);
+    free(job->vertices);
+    free(job);
+}
+
+static void *meshLoop(void *slot) {
+    MeshScratch scratch = {NULL, NULL, NULL, 0};
+    MeshJob *job;
+
+    pthread_mutex_lock(&lock);
+
+    while (!quitMeshing) {
+        if (!(job = popJob(&todo))) {
+            pthread_cond_wait(&jobsReady, &lock);
+            continue;
+        }
+
+        *(MeshJob**)slot = job;
+        pthread_mutex_unlock(&lock);
+
+        job->num_vertices = buildChunkVertices(job->copy, &scratch, &job->vertices);
+
+        pthread_mutex_lock(&lock);
+        *(MeshJob**)slot = NULL;
+        pushJob(&done, job);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    freeMeshScratch(&scratch);
+
+    return NULL;
+}
+
+// one mesh thread per core, leaving one for the main thread
+void startMeshing() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    num_threads = (cores > MAX_MESH_THREADS) ? MAX_MESH_THREADS : (cores > 2) ? cores - 1 : 1;
+    quitMeshing = 0;
+
+    for (i = 0; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, meshLoop, &working[i]);
+}
+
+// waits for the mesh threads to finish what they're on, and throws away the
+// meshes that were still waiting
+void stopMeshing() {
+    MeshJob *job;
+    int i;
+
+    pthread_mutex_lock(&lock);
+    quitMeshing = 1;
+    pthread_cond_broadcast(&jobsReady);
+    pthread_mutex_unlock(&lock);
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    num_threads = 0;
+
+    while ((job = popJob(&todo)) || (job = popJob(&done))) {
+        if (job->chunk)
+            job->chunk->mesh_pending--;
+
+        freeJob(job);
+    }
+}
+
+// remeshes the chunk on a mesh thread, or right away if there aren't any
+void queueChunkMesh(Chunk *chunk) {
+    MeshJob *job;
+
+    if (!num_threads) {
+        renderChunk(chunk);
+        return;
+    }
+
+    job = calloc(1, sizeof(MeshJob));
+    job->chunk = chunk;
+    job->copy = copyChunkForMeshing(chunk);
+    job->request = ++chunk->mesh_requests;
+    chunk->mesh_pending++;
+
+    pthread_mutex_lock(&lock);
+    pushJob(&todo, job);
+    pthread_cond_signal(&jobsReady);
+    pthread_mutex_unlock(&lock);
+}
+
+// uploads the meshes that have been built since the last call, in the order they
+// finished. A mesh that was asked for before the one already shown is dropped
+void applyChunkMeshes() {
+    MeshJob *job, *next;
+
+    pthread_mutex_lock(&lock);
+    job = done.first;
+    done.first = done.last = NULL;
+    pthread_mutex_unlock(&lock);
+
+    for (; job; job = next) {
+        next = job->next;
+
+        if (job->chunk) {
+            job->chunk->mesh_pending--;
+            keepMeshCache(job->chunk, job->copy);
+
+            if (job->request > job->chunk->mesh_shown) {
+                uploadChunkMesh(job->chunk, job->vertices, job->num_vertices);
+                job->chunk->mesh_shown = job->request;
+            }
+        }
+
+        freeJob(job);
+    }
+}
+
+// called as the chunk is freed, so that its meshes aren't uploaded to whatever
+// takes its place
+void cancelChunkMeshes(Chunk *chunk) {
+    MeshJob *job;
+    int i;
+
+    pthread_mutex_lock(&lock);
+
+    for (job = todo.first; job; job = job->next)
+        if (job->chunk == chunk)
+            job->chunk = NULL;
+
+    for (job = done.first; job; job = job->next)
+        if (job->chunk == chunk)
+            job->chunk = NULL;
+
+    for (i = 0; i < num_threads; i++)
+        if (working[i] && working[i]->chunk == chunk)
+            working[i]->chunk = NULL;
+
+    pthread_mutex_unlock(&lock);
+
+    chunk->mesh_pending = 0;
+}
@@ -0,0 +1,13 @@
+#ifndef MESHING_H_
+#define MESHING_H_
+
+#include "voxels.h"
+
+void startMeshing();
+void stopMeshing();
+
+void queueChunkMesh(Chunk *chunk);
+void applyChunkMeshes();
+void cancelChunkMeshes(Chunk *chunk);
+
+#endif
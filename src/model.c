@@ -4,28 +4,30 @@
 
 #include "model.h"
 #include "mesh.h"
+#include "pool.h"
+#include "logic.h"
 
 extern int useMeshing;
 
-Model *createModel() {
-    Model *model = calloc(1, sizeof(Model));
+static Pool modelPool = POOL(Model, 256);
 
-    model->chunk = createChunk(0, 0, 0);
+// models are only meshed on the main thread, which keeps its room for it here
+static MeshScratch modelScratch;
+
+static void freeTurns(Model *model) {
+    int i;
 
-    for (int x = 0; x < CHUNK_SIZE; x++) {
-        for (int y = 0; y < CHUNK_SIZE; y++) {
-            for (int z = 0; z < CHUNK_SIZE; z++) {
-                Block *block = getBlock(model->chunk, x, y, z);
-
-                if (x < CHUNK_SIZE - 1) block->nb_pos_x = getBlock(model->chunk, x+1, y, z);
-                if (x > 0) block->nb_neg_x = getBlock(model->chunk, x-1, y, z);
-                if (y < CHUNK_SIZE - 1) block->nb_pos_y = getBlock(model->chunk, x, y+1, z);
-                if (y > 0) block->nb_neg_y = getBlock(model->chunk, x, y-1, z);
-                if (z < CHUNK_SIZE - 1) block->nb_pos_z = getBlock(model->chunk, x, y, z+1);
-                if (z > 0) block->nb_neg_z = getBlock(model->chunk, x, y, z-1);
-            }
-        }
+    for (i = 0; i < 64; i++) {
+        free(model->turned[i]);
+        model->turned[i] = NULL;
     }
+}
+
+Model *createModel() {
+    Model *model = poolAlloc(&modelPool);
+
+    model->chunk = createChunk(0, 0, 0);
+    model->refs = 1;
 
     return model;
 }
@@ -57,55 +59,104 @@ void writeModel(Chunk *chunk, char *file_path) {
     fclose(out);
 }
 
+// chunks draw their models as instances of the model's mesh, so nothing else
+// holds on to the arrays
 void renderModel(Model *model) {
     if (model->chunk->mesh)
         freeMesh(model->chunk->mesh);
 
-    unsigned int max_points = countChunkSize(model->chunk);
+    freeTurns(model);
 
-    model->points = malloc(max_points * sizeof(GLfloat));
-    model->normals = malloc(max_points * sizeof(GLfloat));
-    model->colors = malloc(max_points * sizeof(GLfloat));
+    free(model->points);
+    free(model->normals);
+    free(model->colors);
+    model->points = model->normals = model->colors = NULL;
+    model->n_points = 0;
+
+    unsigned int max_points = countChunkSize(model->chunk);
 
     if (max_points == 0) {
         *model->chunk->mesh = EMPTY_MESH;
-        model->n_points = 0;
         return;
     }
 
+    model->points = malloc(max_points * sizeof(GLfloat));
+    model->normals = malloc(max_points * sizeof(GLfloat));
+    model->colors = malloc(max_points * sizeof(GLfloat));
+
     if (useMeshing)
-        model->n_points = renderChunkWithMeshing(model->chunk, model->points, model->normals, model->colors, (vec3){0, 0, 0}, 1.0);
+        model->n_points = renderChunkWithBinaryMeshing(model->chunk, &modelScratch, model->points, model->normals, model->colors, (vec3){0, 0, 0}, 1.0);
     else
         model->n_points = renderChunkToArrays(model->chunk, model->points, model->normals, model->colors, (vec3){0, 0, 0}, 1.0);
 
-    buildMesh(model->chunk->mesh, model->points, model->normals, model->colors, NULL, NULL,
-              model->n_points * sizeof(GLfloat), model->n_points * sizeof(GLfloat),
-              model->n_points * sizeof(GLfloat), 0, 0,
-              model->n_points / 3);
+    // the arrays are kept for as long as the model is, and meshing merges most
+    // faces, so they're cut down to what was used
+    if (model->n_points == 0) {
+        free(model->points);
+        free(model->normals);
+        free(model->colors);
+        model->points = model->normals = model->colors = NULL;
+    } else if (model->n_points < max_points) {
+        model->points = realloc(model->points, model->n_points * sizeof(GLfloat));
+        model->normals = realloc(model->normals, model->n_points * sizeof(GLfloat));
+        model->colors = realloc(model->colors, model->n_points * sizeof(GLfloat));
+    }
+
+    buildQuadMesh(model->chunk->mesh, model->points, model->normals, model->colors, model->n_points / 3);
 }
 
-int addRenderedModel(Model *model, GLfloat *points, GLfloat *normals, GLfloat *colors, mat4 rotate, vec3 offset, float scale) {
-    int i;
+// the points and normals of the model turned about its middle. Only the main
+// thread renders models, so the turns are filled in without locking
+static GLfloat *turnModel(Model *model, int rotation) {
+    GLfloat *turned = model->turned[rotation];
+    mat4 turn;
 
-    for (i=0; i < model->n_points; i += 3) {
-        copy_v3(&points[i], &model->points[i]);
-        translate_v3f(&points[i], -CHUNK_WIDTH/2.0, -CHUNK_WIDTH/2.0, -CHUNK_WIDTH/2.0);
-        multiply_v3_m4(&points[i], rotate, 1.0);
-        translate_v3f(&points[i], CHUNK_WIDTH/2.0, CHUNK_WIDTH/2.0, CHUNK_WIDTH/2.0);
-        scale_v3(&points[i], scale);
-        translate_v3v(&points[i], offset);
-        copy_v3(&normals[i], &model->normals[i]);
-        multiply_v3_m4(&normals[i], rotate, 1.0);
-        copy_v3(&colors[i], &model->colors[i]);
+    if (turned)
+        return turned;
+
+    turned = malloc(2 * model->n_points * sizeof(GLfloat));
+
+    identity_m4(turn);
+    translate_m4(turn, -MODEL_WIDTH/2.0, -MODEL_WIDTH/2.0, -MODEL_WIDTH/2.0);
+    multiply_m4(turn, *getRotationMatrix(rotation));
+    translate_m4(turn, MODEL_WIDTH/2.0, MODEL_WIDTH/2.0, MODEL_WIDTH/2.0);
+
+    multiply_vertices_m4(turned, turned + model->n_points, model->points, model->normals, model->n_points / 3, turn);
+
+    model->turned[rotation] = turned;
+
+    return turned;
+}
+
+// rotation is one of the turns of logic blocks, where 0 leaves the model as it is
+int addRenderedModel(Model *model, GLfloat *points, GLfloat *normals, GLfloat *colors, int rotation, vec3 offset, float scale) {
+    GLfloat *turned_points = model->points, *turned_normals = model->normals;
+    mat4 place;
+
+    if (model->n_points == 0)
+        return 0;
+
+    if (rotation) {
+        turned_points = turnModel(model, rotation);
+        turned_normals = turned_points + model->n_points;
     }
 
+    identity_m4(place);
+    scale_m4(place, scale);
+    translate_m4(place, VALUES(offset));
+
+    multiply_vertices_m4(points, NULL, turned_points, NULL, model->n_points / 3, place);
+
+    memcpy(normals, turned_normals, model->n_points * sizeof(GLfloat));
+    memcpy(colors, model->colors, model->n_points * sizeof(GLfloat));
+
     return model->n_points;
 }
 
 void insertModel(Model *model, Block *block) {
     block->active = 1;
     block->color.all = 0;
-    block->data = copyModel(model);
+    block->data = shareModel(model);
     block->logic = NULL;
 }
 
@@ -113,11 +164,13 @@ void freeModel(Model *model) {
     if (model->chunk)
         freeChunk(model->chunk);
 
+    freeTurns(model);
+
     free(model->points);
     free(model->normals);
     free(model->colors);
 
-    free(model);
+    poolFree(&modelPool, model);
 }
 
 Model *copyModel(Model *model) {
@@ -129,3 +182,28 @@ Model *copyModel(Model *model) {
 
     return ret;
 }
+
+Model *shareModel(Model *model) {
+    model->refs++;
+
+    return model;
+}
+
+void releaseModel(Model *model) {
+    if (--model->refs == 0)
+        freeModel(model);
+}
+
+// models are shared, so this should be called before changing the blocks of
+// one. Returns a model with the same blocks that nothing else refers to
+Model *unshareModel(Model *model) {
+    Model *copy;
+
+    if (model->refs == 1)
+        return model;
+
+    copy = copyModel(model);
+    releaseModel(model);
+
+    return copy;
+}
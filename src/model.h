@@ -10,18 +10,30 @@ typedef struct Model_S {
     GLfloat *points, *normals, *colors;
     int n_points;
 
+    // the model as each of the logic turns leaves it, points then normals. Made
+    // the first time the turn is placed, and thrown away when the model changes
+    GLfloat *turned[64];
+
     Chunk *chunk;
+
+    // a placed model is shared by every block it was placed in, and freed
+    // once the last of them lets go of it
+    unsigned int refs;
 } Model;
 
 Model *createModel();
 void freeModel(Model *model);
 Model *copyModel(Model *model);
 
+Model *shareModel(Model *model);
+void releaseModel(Model *model);
+Model *unshareModel(Model *model);
+
 void readModel(Model *model, char *file_path);
 void writeModel(Chunk *chunk, char *file_path);
 
 void renderModel(Model *model);
-int addRenderedModel(Model *model, GLfloat *points, GLfloat *normals, GLfloat *colors, mat4 rotate, vec3 offset, float scale);
+int addRenderedModel(Model *model, GLfloat *points, GLfloat *normals, GLfloat *colors, int rotation, vec3 offset, float scale);
 void insertModel(Model *model, Block *block);
 
 #endif
@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+#define objectSize(pool) (((pool)->object_size + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+// returns a zeroed object
+void *poolAlloc(Pool *pool) {
+    void *ptr;
+
+    if (pool->free_list) {
+        ptr = pool->free_list;
+        pool->free_list = *(void**)ptr;
+    } else {
+        if (!pool->num_slabs || pool->slab_used == pool->per_slab) {
+            pool->slabs = realloc(pool->slabs, (pool->num_slabs + 1) * sizeof(char*));
+            pool->slabs[pool->num_slabs++] = malloc(pool->per_slab * objectSize(pool));
+            pool->slab_used = 0;
+        }
+
+        ptr = pool->slabs[pool->num_slabs - 1] + pool->slab_used++ * objectSize(pool);
+    }
+
+    memset(ptr, 0, pool->object_size);
+
+    return ptr;
+}
+
+void poolFree(Pool *pool, void *ptr) {
+    if (!ptr)
+        return;
+
+    *(void**)ptr = pool->free_list;
+    pool->free_list = ptr;
+}
+
+// frees every object that came from the pool, whether or not it was freed.
+// The pool is left empty, and can still be used
+void freePool(Pool *pool) {
+    unsigned int i;
+
+    for (i = 0; i < pool->num_slabs; i++)
+        free(pool->slabs[i]);
+
+    free(pool->slabs);
+
+    pool->slabs = NULL;
+    pool->num_slabs = pool->slab_used = 0;
+    pool->free_list = NULL;
+}
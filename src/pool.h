@@ -0,0 +1,27 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+// objects are rounded up to this, so that anything can be stored in them
+#define POOL_ALIGN 16
+
+#define POOL(type, per_slab) {sizeof(type), (per_slab)}
+
+// hands out objects of one size from slabs of per_slab objects at a time.
+// Freed objects go on a free list and are handed out again before the slabs
+// grow, and the slabs themselves are only freed all at once by freePool.
+// Pools aren't locked, so each should only be used from one thread
+typedef struct Pool_S {
+    unsigned int object_size, per_slab;
+
+    void *free_list;
+
+    // objects are taken from the end of the last slab until it is used up
+    unsigned int num_slabs, slab_used;
+    char **slabs;
+} Pool;
+
+void *poolAlloc(Pool *pool);
+void poolFree(Pool *pool, void *ptr);
+void freePool(Pool *pool);
+
+#endif
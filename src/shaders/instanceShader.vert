@@ -0,0 +1,38 @@
+#version 330 core
+
+// models are drawn once per block they're placed in. Each instance is the block
+// in the chunk, and which of the turns of logic blocks it's turned by
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec3 vertexColor;
+layout(location = 4) in uvec4 instanceData;
+
+uniform mat4 projectionMatrix;
+uniform mat4 viewMatrix;
+uniform mat4 modelMatrix;
+
+uniform mat3 rotations[64];
+uniform float modelWidth;
+
+out vec3 fragmentColor;
+out vec3 normal_cameraspace;
+out vec3 eyeDirection_cameraspace;
+
+void main(void)
+{
+    mat3 rotation = rotations[instanceData.w];
+
+    // the model is turned about its middle, and shrunk down to a block
+    vec3 position = rotation * (vertexPosition / modelWidth - 0.5) + vec3(instanceData.xyz) + 0.5;
+
+    vec4 position_worldspace = modelMatrix * vec4(position, 1);
+    vec4 position_cameraspace = viewMatrix * position_worldspace;
+
+    gl_Position = projectionMatrix * position_cameraspace;
+
+    eyeDirection_cameraspace = -position_cameraspace.xyz;
+
+    normal_cameraspace = (viewMatrix * modelMatrix * vec4(rotation * vertexNormal, 0)).xyz;
+
+    fragmentColor = vertexColor;
+}
@@ -1,9 +1,15 @@
 #version 330 core
 
-layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexNormal;
+// chunk meshes are packed: the position is in steps that the model matrix scales
+// up, and w is which face of a cube the vertex is on
+layout(location = 0) in uvec4 vertexData;
 layout(location = 2) in vec3 vertexColor;
-layout(location = 3) in vec2 vertexUV;
+
+const vec3 faceNormals[6] = vec3[6](
+    vec3(-1, 0, 0), vec3(1, 0, 0),
+    vec3(0, -1, 0), vec3(0, 1, 0),
+    vec3(0, 0, -1), vec3(0, 0, 1)
+);
 
 // struct LightInfo {
 //     vec4 positionRadius;
@@ -27,6 +33,9 @@ out vec3 eyeDirection_cameraspace;
 
 void main(void)
 {
+    vec3 vertexPosition = vec3(vertexData.xyz);
+    vec3 vertexNormal = faceNormals[vertexData.w];
+
     vec4 position_worldspace = modelMatrix * vec4(vertexPosition, 1);
     vec4 position_cameraspace = viewMatrix * position_worldspace;
 
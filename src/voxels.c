@@ -3,28 +3,50 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <math.h>
 
 #include "voxels.h"
 #include "main.h"
 #include "model.h"
 #include "logic.h"
+#include "meshing.h"
 #include <time.h>
 
 #define BLOCK_MASK (CHUNK_SIZE - 1)
+#define STREAM_LOADS_PER_TICK 8
+// the swap file is compacted once it's this big and mostly parts no longer in use
+#define SWAP_COMPACT_SIZE (16 << 20)
+#define MAX_MESH_TRIES 3
+
+#define chunkIsEmpty(chunk) ((chunk)->uniform && (chunk)->palette_size == 1)
 
 // static int countChunkSize(Chunk *chunk);
 static void getFaceData(const GLfloat *dest, const GLfloat *src, const GLuint *indices);
+static void insertChunk(World *world, Chunk *chunk);
+static void updateChunkNode(Chunk *chunk);
+static ChunkLocation *findLocation(WorldStream *stream, int x, int y, int z);
+static int locationHasBlocks(ChunkLocation *location);
+static Chunk *loadChunk(World *world, ChunkLocation *location);
+static int renderCachedChunk(Chunk *chunk, const ChunkRow *dirty, MeshScratch *scratch);
+static int renderBlocksToArrays(Chunk *chunk, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale, int models);
+static void dirtyAllSlices(Chunk *chunk);
 
 int useMeshing = 1;
 
+// the main thread's room for meshing chunks
+static MeshScratch mainScratch;
+
+// each face is a quad, which the shared quad indices draw as the triangles
+// (0, 1, 2) and (0, 2, 3)
 static const GLuint cubeIndices[] = {
-    7, 5, 4, 7, 4, 6, // x+
-    7, 6, 2, 7, 2, 3, // y+
-    7, 3, 1, 7, 1, 5, // z+
-    0, 1, 3, 0, 3, 2, // x-
-    0, 4, 5, 0, 5, 1, // y-
-    0, 2, 6, 0, 6, 4  // z-
+    7, 5, 4, 6, // x+
+    7, 6, 2, 3, // y+
+    7, 3, 1, 5, // z+
+    0, 1, 3, 2, // x-
+    0, 4, 5, 1, // y-
+    0, 2, 6, 4  // z-
 };
 
 static const GLfloat cubeNormals[] = {
@@ -32,614 +54,2604 @@ static const GLfloat cubeNormals[] = {
 };
 
 static const GLuint zeroIndices[] = {
-    0, 0, 0, 0, 0, 0
+    0, 0, 0, 0
 };
 
-static mat4 identityMatrix = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+#define INDEX_WORDS(bits) ((BLOCKS_PER_CHUNK * (bits)) / (8 * sizeof(unsigned int)))
 
-Chunk * createChunk(int x, int y, int z) {
-    Chunk *chunk = calloc(1, sizeof(Chunk));
+// shared, read-only indices for uniform chunks. With 0 bits every block reads
+// as palette entry 0 (air), with 1 bit and all bits set every block reads as entry 1
+static unsigned int emptyIndices[1];
+static unsigned int solidIndices[INDEX_WORDS(1)];
 
-    chunk->x = x;
-    chunk->y = y;
-    chunk->z = z;
+static inline void setRowBit(ChunkRow *rows, int i, int value) {
+    if (value)
+        rows[blockRow(i)] |= blockBit(i);
+    else
+        rows[blockRow(i)] &= ~blockBit(i);
+}
 
-    chunk->mesh = createMesh();
+// the number of blocks in a row
+static inline int rowCount(ChunkRow bits) {
+    int count = 0;
 
-    return chunk;
+    for (; bits; bits &= bits - 1)
+        count++;
+
+    return count;
 }
 
-void copyChunk(Chunk *dest, Chunk *src) {
-    Block *srcBlock, *destBlock;
+// recounts the blocks of a chunk whose rows were written directly, rather than through storeBlock
+static void countChunk(Chunk *chunk) {
+    int row;
 
-    for (int x = 0; x < CHUNK_SIZE; x++) {
-        for (int y = 0; y < CHUNK_SIZE; y++) {
-            for (int z = 0; z < CHUNK_SIZE; z++) {
-                srcBlock = getBlock(src, x, y, z);
-                destBlock = getBlock(dest, x, y, z);
+    chunk->num_active = chunk->num_models = chunk->num_logic = 0;
 
-                destBlock->active = srcBlock->active;
-                destBlock->color = srcBlock->color;
+    for (row = 0; row < CHUNK_ROWS; row++) {
+        chunk->num_active += rowCount(chunkActiveRow(chunk, row));
 
-                if (destBlock->logic) {
-                    free(destBlock->logic);
-                    destBlock->logic = NULL;
-                }
+        if (chunk->extra) {
+            chunk->num_models += rowCount(chunk->model_rows[row]);
+            chunk->num_logic += rowCount(chunk->logic_rows[row]);
+        }
+    }
+}
 
-                if (destBlock->data) {
-                    destBlock->data = NULL;
-                }
+// shrinks the box around the chunk's active blocks to fit them
+static void fitChunkBounds(Chunk *chunk) {
+    int min[3] = {CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE}, max[3] = {0, 0, 0};
+    int row, y, z, i;
+    ChunkRow bits, all = 0;
 
-                if (srcBlock->logic) {
-                    destBlock->logic = calloc(1, sizeof(Logic));
-                    memcpy(destBlock->logic, srcBlock->logic, sizeof(Logic));
-                    updateLogicModel(destBlock);
-                } else if (srcBlock->data) {
-                    destBlock->data = createModel();
-                    copyChunk(destBlock->data->chunk, srcBlock->data->chunk);
-                    renderModel(destBlock->data);
-                }
-            }
+    if (chunk->uniform) {
+        for (i = 0; i < 3; i++) {
+            chunk->min[i] = 0;
+            chunk->max[i] = chunk->num_active ? CHUNK_SIZE : 0;
         }
+
+        return;
     }
 
-    renderChunk(dest);
-}
+    for (row = 0; row < CHUNK_ROWS; row++) {
+        bits = chunkActiveRow(chunk, row);
 
-void renderChunk(Chunk *chunk) {
-    // free the previously used buffers. Memory leaks are bad, mmkay.
-    if (chunk->mesh)
-        freeMesh(chunk->mesh);
+        if (!bits)
+            continue;
 
-    // 6 faces per cube * 2 triangles per face * 3 vertices per triangle * 3 coordinates per vertex
-    unsigned int max_points = countChunkSize(chunk);//6 * 6 * 3 * CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+        y = row >> LOG_CHUNK_SIZE;
+        z = row & BLOCK_MASK;
+        all |= bits;
 
-    // don't render an empty chunk :p
-    if (max_points == 0) {
-        *chunk->mesh = EMPTY_MESH;
-        return;
+        if (y < min[1]) min[1] = y;
+        if (y >= max[1]) max[1] = y + 1;
+        if (z < min[2]) min[2] = z;
+        if (z >= max[2]) max[2] = z + 1;
     }
 
-    GLfloat *points = malloc(max_points * sizeof(GLfloat));
-    GLfloat *normals = malloc(max_points * sizeof(GLfloat));
-    GLfloat *colors = malloc(max_points * sizeof(GLfloat));
+    // rows run along x, so the ends along x are the lowest and highest bits of any row
+    for (i = 0; all; i++, all >>= 1) {
+        if (!(all & 1))
+            continue;
 
-    int size;
+        if (i < min[0]) min[0] = i;
+        max[0] = i + 1;
+    }
 
-    if (useMeshing)
-        size = renderChunkWithMeshing(chunk, points, normals, colors, (vec3){0, 0, 0}, 1.0);
-    else
-        size = renderChunkToArrays(chunk, points, normals, colors, (vec3){0, 0, 0}, 1.0);
+    for (i = 0; i < 3; i++) {
+        chunk->min[i] = max[i] ? min[i] : 0;
+        chunk->max[i] = max[i];
+    }
+}
 
-    buildMesh(chunk->mesh, points, normals, colors, NULL, NULL,
-              size * sizeof(GLfloat), size * sizeof(GLfloat),
-              size * sizeof(GLfloat), 0, 0,
-              size / 3);
+// stretches the chunk's box to cover block (x, y, z)
+static inline void growChunkBounds(Chunk *chunk, int x, int y, int z) {
+    if (!chunk->num_active) {
+        chunk->min[0] = x; chunk->min[1] = y; chunk->min[2] = z;
+        chunk->max[0] = x + 1; chunk->max[1] = y + 1; chunk->max[2] = z + 1;
+        return;
+    }
 
-    translate_m4(chunk->mesh->modelMatrix,
-                 chunk->x * CHUNK_WIDTH,
-                 chunk->y * CHUNK_WIDTH,
-                 chunk->z * CHUNK_WIDTH);
+    if (x < chunk->min[0]) chunk->min[0] = x;
+    if (y < chunk->min[1]) chunk->min[1] = y;
+    if (z < chunk->min[2]) chunk->min[2] = z;
+    if (x >= chunk->max[0]) chunk->max[0] = x + 1;
+    if (y >= chunk->max[1]) chunk->max[1] = y + 1;
+    if (z >= chunk->max[2]) chunk->max[2] = z + 1;
+}
 
-    free(points);
-    free(normals);
-    free(colors);
+// where block pos of a chunk's side along axis is in the borders of that side
+static inline void borderSpot(int axis, const int *pos, int *line, int *bit) {
+    *line = (axis == 2) ? pos[1] : pos[2];
+    *bit = (axis == 0) ? pos[1] : pos[0];
 }
 
-int countChunkSize(Chunk *chunk) {
-    int x, y, z;
-    int count = 0;
-    Block *block;
+// whether the neighbor in direction d has a cube against block (x, y, z), which is on that side
+static inline int coveredByNeighbor(const Chunk *chunk, int d, int x, int y, int z) {
+    int pos[3] = {x, y, z}, line, bit;
 
-    for (x = 0; x < CHUNK_SIZE; x++) {
-        for (y = 0; y < CHUNK_SIZE; y++) {
-            for (z = 0; z < CHUNK_SIZE; z++) {
-                block = getBlock(chunk, x, y, z);
+    borderSpot(d / 2, pos, &line, &bit);
 
-                if (block->active) {
-                    if (block->data)
-                        count += countChunkSize(block->data->chunk);
-                    // due to some multithreading issues, we may have to over-report
-                    else if (block->logic)
-                        count += countChunkSize(getLogicModel(block->logic->type, 0)->chunk);
-                    else
-                        count += 12 * 3 * 3;
-                }
-            }
+    return (chunk->borders[d][line] >> bit) & 1;
+}
+
+// the faces on the side are meshed again, along with the chunk
+static void borderChanged(Chunk *chunk, int d) {
+    __atomic_fetch_or(&chunk->mesh_dirty[d], (ChunkRow)1 << ((d & 1) ? CHUNK_SIZE - 1 : 0), __ATOMIC_RELAXED);
+    chunk->needsUpdate = 1;
+}
+
+// fills in the side of chunk facing direction d from the layer of nb that touches
+// it, or clears it if there's no neighbor there
+static void fillBorder(Chunk *chunk, int d, const Chunk *nb) {
+    ChunkRow border[CHUNK_SIZE];
+    int layer = (d & 1) ? 0 : CHUNK_SIZE - 1;
+    int line, i;
+
+    memset(border, 0, sizeof(border));
+
+    for (line = 0; nb && line < CHUNK_SIZE; line++) {
+        switch (d / 2) {
+        // rows run along x, so the x sides take a bit out of each row
+        case 0:
+            for (i = 0; i < CHUNK_SIZE; i++)
+                border[line] |= ((chunkCubeRow(nb, rowIndex(i, line)) >> layer) & 1) << i;
+            break;
+        case 1:
+            border[line] = chunkCubeRow(nb, rowIndex(layer, line));
+            break;
+        case 2:
+            border[line] = chunkCubeRow(nb, rowIndex(line, layer));
+            break;
         }
     }
 
-    return count;
+    if (memcmp(border, chunk->borders[d], sizeof(border))) {
+        memcpy(chunk->borders[d], border, sizeof(border));
+        borderChanged(chunk, d);
+    }
 }
 
-// returns the number of elements added to the arrays
-int renderChunkToArrays(Chunk *chunk, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale) {
-    float blockWidth = BLOCK_WIDTH * scale;
-
-    Block *block;
-    vec3 color;
-    int x, y, z;
-    float min_x, min_y, min_z, max_x, max_y, max_z;
+// tells the neighbors about a whole chunk's worth of changes
+static void updateBorders(Chunk *chunk) {
+    int d;
 
-    GLfloat cube_vertices[8 * 3];
-    GLuint zeroIndices[] = {0, 0, 0, 0, 0, 0};
+    for (d = 0; d < 6; d++)
+        if (chunk->neighbors[d])
+            fillBorder(chunk->neighbors[d], d ^ 1, chunk);
+}
 
-    int points_index = 0;
+// tells the neighbors about block (x, y, z), if it's on the side of the chunk
+static void updateBorderBlock(Chunk *chunk, int x, int y, int z) {
+    int pos[3] = {x, y, z}, axis, d, line, bit;
+    ChunkRow mask, row;
+    Chunk *nb;
+
+    for (axis = 0; axis < 3; axis++) {
+        if (pos[axis] == 0)
+            d = axis * 2;
+        else if (pos[axis] == CHUNK_SIZE - 1)
+            d = axis * 2 + 1;
+        else
+            continue;
+
+        if (!(nb = chunk->neighbors[d]))
+            continue;
+
+        borderSpot(axis, pos, &line, &bit);
+        mask = (ChunkRow)1 << bit;
+        row = blockIsCube(chunk, blockIndex(x, y, z)) ? (nb->borders[d ^ 1][line] | mask) : (nb->borders[d ^ 1][line] & ~mask);
+
+        if (row != nb->borders[d ^ 1][line]) {
+            nb->borders[d ^ 1][line] = row;
+            borderChanged(nb, d ^ 1);
+        }
+    }
+}
 
-    for (x = 0; x < CHUNK_SIZE; x++) {
-        min_x = x * blockWidth + offset[0];
-        max_x = min_x + blockWidth;
+static void makeUniform(Chunk *chunk, Color color) {
+    if (!chunk->uniform)
+        free(chunk->indices);
 
-        for (y = 0; y < CHUNK_SIZE; y++) {
-            min_y = y * blockWidth + offset[1];
-            max_y = min_y + blockWidth;
+    free(chunk->active_rows);
+    chunk->active_rows = NULL;
 
-            for (z = 0; z < CHUNK_SIZE; z++) {
-                min_z = z * blockWidth + offset[2];
-                max_z = min_z + blockWidth;
+    if (!solidIndices[0])
+        memset(solidIndices, 0xFF, sizeof(solidIndices));
 
-                block = getBlock(chunk, x, y, z);
+    chunk->uniform = 1;
+    chunk->palette[0] = (Color){.all = 0};
 
-                if (!block->active) {
-                    continue;
-                }
+    if (color.all) {
+        chunk->palette[1] = color;
+        chunk->palette_size = 2;
+        chunk->index_bits = 1;
+        chunk->indices = solidIndices;
+    } else {
+        chunk->palette_size = 1;
+        chunk->index_bits = 0;
+        chunk->indices = emptyIndices;
+    }
 
-                if (block->data) {
-                    if (block->data->chunk->needsUpdate) {
-                        renderModel(block->data);
-                        block->data->chunk->needsUpdate = 0;
-                    }
+    // uniform chunks never have models or logic blocks
+    chunk->num_active = color.all ? BLOCKS_PER_CHUNK : 0;
+    chunk->num_models = chunk->num_logic = 0;
+    fitChunkBounds(chunk);
+    dirtyAllSlices(chunk);
+    updateBorders(chunk);
+}
 
-                    if (block->logic)
-                        points_index += addRenderedModel(
-                            block->data,
-                            &points[points_index],
-                            &normals[points_index],
-                            &colors[points_index],
-                            *block->logic->rotationMatrix,
-                            (vec3){min_x, min_y, min_z},
-                            scale / CHUNK_SIZE
-                        );
-                    else
-                        points_index += addRenderedModel(
-                            block->data,
-                            &points[points_index],
-                            &normals[points_index],
-                            &colors[points_index],
-                            identityMatrix,
-                            (vec3){min_x, min_y, min_z},
-                            scale / CHUNK_SIZE
-                        );
-                    continue;
-                }
+// gives a uniform chunk its own indices so that blocks can be changed
+static void promoteChunk(Chunk *chunk) {
+    chunk->indices = calloc(INDEX_WORDS(1), sizeof(unsigned int));
+    chunk->active_rows = calloc(CHUNK_ROWS, sizeof(ChunkRow));
 
-                cube_vertices[ 0] = min_x; cube_vertices[ 1] = min_y; cube_vertices[ 2] = min_z;
-                cube_vertices[ 3] = min_x; cube_vertices[ 4] = min_y; cube_vertices[ 5] = max_z;
-                cube_vertices[ 6] = min_x; cube_vertices[ 7] = max_y; cube_vertices[ 8] = min_z;
-                cube_vertices[ 9] = min_x; cube_vertices[10] = max_y; cube_vertices[11] = max_z;
-                cube_vertices[12] = max_x; cube_vertices[13] = min_y; cube_vertices[14] = min_z;
-                cube_vertices[15] = max_x; cube_vertices[16] = min_y; cube_vertices[17] = max_z;
-                cube_vertices[18] = max_x; cube_vertices[19] = max_y; cube_vertices[20] = min_z;
-                cube_vertices[21] = max_x; cube_vertices[22] = max_y; cube_vertices[23] = max_z;
+    if (chunk->index_bits) {
+        memset(chunk->indices, 0xFF, INDEX_WORDS(1) * sizeof(unsigned int));
+        memset(chunk->active_rows, 0xFF, CHUNK_ROWS * sizeof(ChunkRow));
+    }
 
-                color[0] = (float)block->color.r / 255.0;
-                color[1] = (float)block->color.g / 255.0;
-                color[2] = (float)block->color.b / 255.0;
+    chunk->index_bits = 1;
+    chunk->uniform = 0;
+}
 
-                // check if each face is visible
-                if (x == CHUNK_SIZE - 1 || !getBlock(chunk, x+1, y, z)->active || getBlock(chunk, x+1, y, z)->data) {
-                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[ 0]);
-                    getFaceData(&normals[points_index],    &cubeNormals[5],    zeroIndices);
-                    getFaceData(&colors[points_index],     color,              zeroIndices);
-                    points_index += 6 * 3;
-                }
+// the logic thread reads the logic blocks of neighboring chunks without locking
+// them, so their models and logic blocks come from a pool. A stale read then only
+// ever sees memory that is still ours, and the version tells it to read again
+static Pool extraPool = POOL(BlockExtra[BLOCKS_PER_CHUNK], 16);
 
-                if (y == CHUNK_SIZE - 1 || !getBlock(chunk, x, y+1, z)->active || getBlock(chunk, x, y+1, z)->data) {
-                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[ 6]);
-                    getFaceData(&normals[points_index],    &cubeNormals[4],    zeroIndices);
-                    getFaceData(&colors[points_index],     color,              zeroIndices);
-                    points_index += 6 * 3;
-                }
+// turns the chunk back into a uniform one if all its blocks are the same plain color
+static void demoteChunk(Chunk *chunk) {
+    unsigned int i, first;
 
-                if (z == CHUNK_SIZE - 1 || !getBlock(chunk, x, y, z+1)->active || getBlock(chunk, x, y, z+1)->data) {
-                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[12]);
-                    getFaceData(&normals[points_index],    &cubeNormals[3],    zeroIndices);
-                    getFaceData(&colors[points_index],     color,              zeroIndices);
-                    points_index += 6 * 3;
-                }
+    if (chunk->uniform)
+        return;
 
-                if (x == 0 || !getBlock(chunk, x-1, y, z)->active || getBlock(chunk, x-1, y, z)->data) {
-                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[18]);
-                    getFaceData(&normals[points_index],    &cubeNormals[2],    zeroIndices);
-                    getFaceData(&colors[points_index],     color,              zeroIndices);
-                    points_index += 6 * 3;
-                }
+    if (chunk->extra) {
+        for (i = 0; i < CHUNK_ROWS; i++) {
+            if (chunk->model_rows[i] || chunk->logic_rows[i])
+                return;
+        }
+    }
 
-                if (y == 0 || !getBlock(chunk, x, y-1, z)->active || getBlock(chunk, x, y-1, z)->data) {
-                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[24]);
-                    getFaceData(&normals[points_index],    &cubeNormals[1],    zeroIndices);
-                    getFaceData(&colors[points_index],     color,              zeroIndices);
-                    points_index += 6 * 3;
-                }
+    first = blockPaletteIndex(chunk, 0);
 
-                if (z == 0 || !getBlock(chunk, x, y, z-1)->active || getBlock(chunk, x, y, z-1)->data) {
-                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[30]);
-                    getFaceData(&normals[points_index],    &cubeNormals[0],    zeroIndices);
-                    getFaceData(&colors[points_index],     color,              zeroIndices);
-                    points_index += 6 * 3;
-                }
-            }
-        }
+    for (i = 1; i < BLOCKS_PER_CHUNK; i++) {
+        if (blockPaletteIndex(chunk, i) != first)
+            return;
     }
 
-    return points_index;
+    poolFree(&extraPool, chunk->extra);
+    free(chunk->model_rows);
+    free(chunk->logic_rows);
+    chunk->extra = NULL;
+    chunk->model_rows = chunk->logic_rows = NULL;
+
+    makeUniform(chunk, chunk->palette[first]);
 }
 
-int renderChunkWithMeshing(Chunk *chunk, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale) {
-    float blockWidth = scale * BLOCK_WIDTH;
+// chunks are created and freed a lot as worlds are loaded and streamed
+static Pool chunkPool = POOL(Chunk, 256);
 
-    Color *face[CHUNK_SIZE][CHUNK_SIZE];
-    unsigned int axis1, axis2, axis3, w, h, i, j, k, points_index, pos[3], dir[3];
-    int sign, empty, models;
-    Block *voxel1, *voxel2;
-    vec3 d_axis2, d_axis3, fpos;
+Chunk * createChunk(int x, int y, int z) {
+    Chunk *chunk = poolAlloc(&chunkPool);
 
-    //Color covered; // placeholder value for covered faces
+    chunk->x = x;
+    chunk->y = y;
+    chunk->z = z;
 
-    vec3 color;
-    GLuint indices[] = {0, 1, 2, 0, 2, 3, 0, 3, 2, 0, 2, 1};
-    GLfloat verts[12];
+    // start out as all air, with room for one color
+    chunk->palette_capacity = 2;
+    chunk->palette = calloc(chunk->palette_capacity, sizeof(Color));
+    makeUniform(chunk, (Color){.all = 0});
 
-    /*
-        axis1 is our "working" axis. We look at both sides of each "slice" of the chunk
-        along that axis, and determine whether each face is visible by checking
-        the block in front of it. For each face that is visible, its color is
-        added to the face array. Then we look at the face array and split it up
-        into rectangles of the same color using a greedy algorithm. We draw each
-        rectangle and then move on to the next axis.
+    chunk->mesh = createMesh();
 
+    return chunk;
+}
 
-        // ***** this is currently removed *****
-        I also implemented (my own idea!) a system where if a block is covered,
-        a placeholder value is inserted in the face array instead. Then, when
-        calculating the rectangles, the placeholder value is treated as a solid
-        block, except for the fact that a rectangle cannot start on a face with
-        the placeholder value. This still prevents faces that are completely
-        hidden from being drawn, but allows for rectangles to be combined under
-        blocks that are hiding different colors. This should result in a strictly
-        smaller number of rectangles being drawn, at near-zero cost :D
-        The only drawback is that large rectangles that are mostly hidden may
-        still be drawn. Everything will still look fine, but there is a little
-        extra cost from drawing the overlapping triangles. My hope is that
-        overall the scene will render even faster.
-    */
+static inline void setPaletteIndex(Chunk *chunk, int i, unsigned int index) {
+    unsigned int bit = i * chunk->index_bits;
+    unsigned int mask = indexMask(chunk->index_bits) << (bit & 31);
 
-    memset(face, 0, sizeof(face));
+    chunk->indices[bit >> 5] = (chunk->indices[bit >> 5] & ~mask) | (index << (bit & 31));
+}
 
-    points_index = 0;
-    models = 0;
+// makes room for at least one more palette entry, first by dropping
+// colors that are no longer used, and if that fails by widening the indices
+static void growPalette(Chunk *chunk) {
+    PaletteIndex *remap;
+    char *used = calloc(chunk->palette_size, sizeof(char));
+    unsigned int i, size, old_bits;
+    unsigned int *old_indices;
 
-    for (axis1 = 0; axis1 < 3; axis1++) {
-        axis2 = (axis1 + 1) % 3;
-        axis3 = (axis1 + 2) % 3;
+    used[0] = 1;
 
-        dir[0] = dir[1] = dir[2] = 0;
-        d_axis2[0] = d_axis2[1] = d_axis2[2] = 0;
-        d_axis3[0] = d_axis3[1] = d_axis3[2] = 0;
+    for (i = 0; i < BLOCKS_PER_CHUNK; i++)
+        used[blockPaletteIndex(chunk, i)] = 1;
 
-        for (sign = -1; sign < 2; sign += 2) {
-            dir[axis1] = sign;
+    remap = malloc(chunk->palette_size * sizeof(PaletteIndex));
 
-            for (pos[axis1] = 0; pos[axis1] < CHUNK_SIZE; pos[axis1]++) {
-                empty = 1;
+    for (i = 0, size = 0; i < chunk->palette_size; i++) {
+        if (used[i]) {
+            remap[i] = size;
+            chunk->palette[size++] = chunk->palette[i];
+        }
+    }
 
-                // generate the face array
-                for (pos[axis2] = 0; pos[axis2] < CHUNK_SIZE; pos[axis2]++) {
-                    for (pos[axis3] = 0; pos[axis3] < CHUNK_SIZE; pos[axis3]++) {
-                        voxel1 = getBlock(chunk, pos[0], pos[1], pos[2]);
-                        voxel2 = ((sign > 0) ? (pos[axis1] < CHUNK_SIZE - 1) : (pos[axis1] > 0)) ?
-                                 getBlock(chunk, pos[0]+dir[0], pos[1]+dir[1], pos[2]+dir[2]) :
-                                 NULL;
+    free(used);
 
-                        if (voxel1->active) {
+    if (size < chunk->palette_size) {
+        for (i = 0; i < BLOCKS_PER_CHUNK; i++)
+            setPaletteIndex(chunk, i, remap[blockPaletteIndex(chunk, i)]);
 
-                            // there's a block that is potentially drawable
-                            empty = 0;
+        chunk->palette_size = size;
+        free(remap);
+        return;
+    }
 
-                            if (voxel1->data)
-                                // there's a model in the chunk. These have to be
-                                // handled separately, so we mark a boolean flag
-                                // so that we know to go back and render them
-                                models = 1;
-                            else if (!voxel2 || !voxel2->active || voxel2->data)
-                                face[pos[axis3]][pos[axis2]] = &voxel1->color;
-                        }
-                    }
-                }
+    free(remap);
 
-                // nothing to do here. Continue on.
-                if (empty)
-                    continue;
+    old_bits = chunk->index_bits;
+    old_indices = chunk->indices;
 
-                /*puts("---------------");
-                printf("____%c%c AXIS____\n", sign > 0 ? '+' : '-', (char[]){'X','Y','Z'}[axis1]);
-                printf("___SLICE #%02d___\n", pos[axis1]);
-                for (i = 0; i < CHUNK_SIZE; i++) {
-                    for (j = 0; j < CHUNK_SIZE; j++) {
-                        printf("%c ", face[j][i] ? '#' : ' ');
-                    }
-                    puts("");
-                }
-                puts("---------------\n");*/
+    chunk->index_bits *= 2;
+    chunk->indices = calloc(INDEX_WORDS(chunk->index_bits), sizeof(unsigned int));
 
-                // cut the face up into rectangles and draw them
-                for (j = 0; j < CHUNK_SIZE; j++) {
-                    for (i = 0; i < CHUNK_SIZE;) {
-                        w = 1;
+    for (i = 0; i < BLOCKS_PER_CHUNK; i++) {
+        unsigned int bit = i * old_bits;
+        setPaletteIndex(chunk, i, (old_indices[bit >> 5] >> (bit & 31)) & indexMask(old_bits));
+    }
 
-                        if (face[j][i]) {
+    free(old_indices);
+}
 
-                            // get the width
-                            while (
-                                (i + w < CHUNK_SIZE) &&
-                                (face[j][i + w]) &&
-                                (face[j][i + w]->all == face[j][i]->all)
-                            ) w++;
+// finds color in the chunk's palette, adding it if it isn't there yet
+static unsigned int paletteIndex(Chunk *chunk, Color color) {
+    unsigned int i;
 
-                            // get the height
-                            for (h = 1; j + h < CHUNK_SIZE; h++) {
+    // air is always the first entry
+    if (!color.all)
+        return 0;
 
-                                // we look at the next row, and make sure each
-                                // block on the face is solid and the same color.
-                                // if it's not, we break from the outer loop
-                                for (k = 0; k < w; k++) {
-                                    if ((face[j + h][i + k] == NULL) ||
-                                        (face[j + h][i + k]->all != face[j][i]->all)
-                                    ) goto done;
-                                }
-                            }
-                            done:
+    for (i = 1; i < chunk->palette_size; i++) {
+        if (chunk->palette[i].all == color.all)
+            return i;
+    }
 
-                            // draw it
+    if (chunk->uniform)
+        promoteChunk(chunk);
+
+    if (chunk->palette_size > indexMask(chunk->index_bits))
+        growPalette(chunk);
+
+    if (chunk->palette_size == chunk->palette_capacity) {
+        chunk->palette_capacity *= 2;
+        chunk->palette = realloc(chunk->palette, chunk->palette_capacity * sizeof(Color));
+    }
+
+    chunk->palette[chunk->palette_size] = color;
 
-                            color[0] = (float)face[j][i]->r / 255.0;
-                            color[1] = (float)face[j][i]->g / 255.0;
-                            color[2] = (float)face[j][i]->b / 255.0;
+    return chunk->palette_size++;
+}
 
-                            fpos[axis1] = pos[axis1] * blockWidth + offset[axis1];
-                            fpos[axis2] = i * blockWidth + offset[axis2];
-                            fpos[axis3] = j * blockWidth + offset[axis3];
+static inline void storeBlockData(Chunk *chunk, int i, Block *block) {
+    if (block->data || block->logic) {
+        if (!chunk->extra) {
+            chunk->extra = poolAlloc(&extraPool);
+            chunk->model_rows = calloc(CHUNK_ROWS, sizeof(ChunkRow));
+            chunk->logic_rows = calloc(CHUNK_ROWS, sizeof(ChunkRow));
+        }
 
-                            d_axis2[axis2] = w * blockWidth;
-                            d_axis3[axis3] = h * blockWidth;
+        chunk->extra[i] = (BlockExtra){block->data, block->logic};
+        setRowBit(chunk->model_rows, i, block->data != NULL);
+        setRowBit(chunk->logic_rows, i, block->logic != NULL);
+    } else if (chunk->extra) {
+        chunk->extra[i] = (BlockExtra){NULL, NULL};
+        setRowBit(chunk->model_rows, i, 0);
+        setRowBit(chunk->logic_rows, i, 0);
+    }
+}
 
-                            if (sign > 0) fpos[axis1] += blockWidth;
+// a copy of the block that can be stored alongside the original
+static Block duplicateBlock(Block block) {
+    Logic *logic = block.logic;
 
-                            verts[ 0] = fpos[0];
-                            verts[ 1] = fpos[1];
-                            verts[ 2] = fpos[2];
-                            verts[ 3] = fpos[0] + d_axis2[0];
-                            verts[ 4] = fpos[1] + d_axis2[1];
-                            verts[ 5] = fpos[2] + d_axis2[2];
-                            verts[ 6] = fpos[0] + d_axis2[0] + d_axis3[0];
-                            verts[ 7] = fpos[1] + d_axis2[1] + d_axis3[1];
-                            verts[ 8] = fpos[2] + d_axis2[2] + d_axis3[2];
-                            verts[ 9] = fpos[0] + d_axis3[0];
-                            verts[10] = fpos[1] + d_axis3[1];
-                            verts[11] = fpos[2] + d_axis3[2];
+    if (logic) {
+        block.logic = createLogic();
+        memcpy(block.logic, logic, sizeof(Logic));
+        updateLogicModel(&block);
+    } else if (block.data) {
+        block.data = shareModel(block.data);
+    }
 
-                            getFaceData(&points[points_index], verts, &indices[((sign < 0) ? 6 : 0)]);
-                            getFaceData(&normals[points_index], &cubeNormals[(sign > 0) ? 5-axis1 : 2-axis1], zeroIndices);
-                            getFaceData(&colors[points_index], color, zeroIndices);
+    return block;
+}
 
-                            points_index += 18;
+// frees the logic blocks of the chunk and lets go of its models. Only the
+// rows with a model or logic block in them are looked at
+static void freeChunkExtra(Chunk *chunk) {
+    BlockExtra *extra;
+    ChunkRow bits;
+    int row, x;
 
-                            // empty the face array wherever we rendered it
-                            for(k = 0; k < h; k++) {
-                                memset(&face[j + k][i], 0, w * sizeof(Color*));
-                            }
-                        }
+    if (!chunk->extra)
+        return;
 
-                        i += w;
-                    }
-                }
-            }
+    for (row = 0; row < CHUNK_ROWS; row++) {
+        bits = chunk->model_rows[row] | chunk->logic_rows[row];
+
+        for (x = 0; bits; x++, bits >>= 1) {
+            if (!(bits & 1))
+                continue;
+
+            extra = &chunk->extra[blockIndex(x, row >> LOG_CHUNK_SIZE, row & BLOCK_MASK)];
+
+            if (extra->logic)
+                freeLogic(extra->logic);
+            else if (extra->data)
+                releaseModel(extra->data);
         }
     }
 
-    if (models) {
+    poolFree(&extraPool, chunk->extra);
+    free(chunk->model_rows);
+    free(chunk->logic_rows);
+    chunk->extra = NULL;
+    chunk->model_rows = chunk->logic_rows = NULL;
+}
+
+// copies the blocks of src over those of dest, without remeshing it. Everything is
+// copied wholesale, and then the models are shared and each logic block gets its
+// own state, in one pass over the rows that have them
+static void copyChunkBlocks(Chunk *dest, Chunk *src) {
+    BlockExtra *extra;
+    Logic *logic;
+    ChunkRow bits;
+    int row, x;
+
+    beginChunkWrite(dest);
+
+    freeChunkExtra(dest);
+
+    // the colors can be copied over wholesale
+    free(dest->palette);
+    free(dest->active_rows);
+    if (!dest->uniform)
+        free(dest->indices);
+
+    dest->palette_size = src->palette_size;
+    dest->palette_capacity = src->palette_capacity;
+    dest->palette = malloc(dest->palette_capacity * sizeof(Color));
+    memcpy(dest->palette, src->palette, dest->palette_size * sizeof(Color));
+
+    dest->uniform = src->uniform;
+    dest->index_bits = src->index_bits;
+
+    dest->num_active = src->num_active;
+    dest->num_models = src->num_models;
+    dest->num_logic = src->num_logic;
+    memcpy(dest->min, src->min, sizeof(dest->min));
+    memcpy(dest->max, src->max, sizeof(dest->max));
+
+    if (src->uniform) {
+        dest->indices = src->indices;
+        dest->active_rows = NULL;
+    } else {
+        dest->indices = malloc(INDEX_WORDS(dest->index_bits) * sizeof(unsigned int));
+        memcpy(dest->indices, src->indices, INDEX_WORDS(dest->index_bits) * sizeof(unsigned int));
+        dest->active_rows = malloc(CHUNK_ROWS * sizeof(ChunkRow));
+        memcpy(dest->active_rows, src->active_rows, CHUNK_ROWS * sizeof(ChunkRow));
+    }
 
-        // there were models in the chunk. Render them
-        for (pos[0] = 0; pos[0] < CHUNK_SIZE; pos[0]++) {
-            for (pos[1] = 0; pos[1] < CHUNK_SIZE; pos[1]++) {
-                for (pos[2] = 0; pos[2] < CHUNK_SIZE; pos[2]++) {
-                    voxel1 = getBlock(chunk, pos[0], pos[1], pos[2]);
+    if (src->extra) {
+        dest->extra = poolAlloc(&extraPool);
+        dest->model_rows = malloc(CHUNK_ROWS * sizeof(ChunkRow));
+        dest->logic_rows = malloc(CHUNK_ROWS * sizeof(ChunkRow));
+        memcpy(dest->extra, src->extra, BLOCKS_PER_CHUNK * sizeof(BlockExtra));
+        memcpy(dest->model_rows, src->model_rows, CHUNK_ROWS * sizeof(ChunkRow));
+        memcpy(dest->logic_rows, src->logic_rows, CHUNK_ROWS * sizeof(ChunkRow));
 
-                    if (voxel1->active && voxel1->data) {
-                        if (voxel1->data->chunk->needsUpdate) {
-                            renderModel(voxel1->data);
-                            voxel1->data->chunk->needsUpdate = 0;
-                        }
+        // logic blocks keep pointing at the same logic model, so only their state is copied
+        for (row = 0; row < CHUNK_ROWS; row++) {
+            bits = dest->model_rows[row] | dest->logic_rows[row];
 
-                        if (voxel1->logic)
-                            points_index += addRenderedModel(
-                                    voxel1->data, &points[points_index], &normals[points_index], &colors[points_index], *voxel1->logic->rotationMatrix,
-                                    (vec3){pos[0]*blockWidth + offset[0], pos[1]*blockWidth + offset[1], pos[2]*blockWidth + offset[2]},
-                                    scale / CHUNK_SIZE
-                                );
-                        else
-                            points_index += addRenderedModel(
-                                    voxel1->data, &points[points_index], &normals[points_index], &colors[points_index], identityMatrix,
-                                    (vec3){pos[0]*blockWidth + offset[0], pos[1]*blockWidth + offset[1], pos[2]*blockWidth + offset[2]},
-                                    scale / CHUNK_SIZE
-                                );
-                    }
+            for (x = 0; bits; x++, bits >>= 1) {
+                if (!(bits & 1))
+                    continue;
+
+                extra = &dest->extra[blockIndex(x, row >> LOG_CHUNK_SIZE, row & BLOCK_MASK)];
+
+                if (extra->logic) {
+                    logic = createLogic();
+                    memcpy(logic, extra->logic, sizeof(Logic));
+                    extra->logic = logic;
+                } else if (extra->data) {
+                    shareModel(extra->data);
                 }
             }
         }
     }
 
-    return points_index;
-}
+    dest->modified = 1;
+    dirtyAllSlices(dest);
+    updateBorders(dest);
 
-void freeChunk(Chunk *chunk) {
-    int x, y, z;
+    endChunkWrite(dest);
+}
+
+void copyChunk(Chunk *dest, Chunk *src) {
+    copyChunkBlocks(dest, src);
+    updateChunkNode(dest);
+    renderChunk(dest);
+}
+
+// copies the model sized part of src starting at block (x, y, z)
+// into the corner of dest, which should be empty
+void copyChunkPart(Chunk *dest, Chunk *src, int x, int y, int z) {
+    int i, j, k;
+
+    for (i = 0; i < MODEL_SIZE; i++) {
+        for (j = 0; j < MODEL_SIZE; j++) {
+            for (k = 0; k < MODEL_SIZE; k++)
+                storeBlock(dest, i, j, k, duplicateBlock(getBlock(src, x + i, y + j, z + k)));
+        }
+    }
+
+    demoteChunk(dest);
+    updateChunkNode(dest);
+    renderChunk(dest);
+}
+
+// makes room for size elements in each of the scratch arrays, keeping what's in them
+void reserveMeshScratch(MeshScratch *scratch, int size) {
+    if (size <= scratch->capacity)
+        return;
+
+    // grow by half again at least, so that a run of growing chunks doesn't realloc every time
+    scratch->capacity = (size > scratch->capacity * 3 / 2) ? size : scratch->capacity * 3 / 2;
+
+    scratch->points = realloc(scratch->points, scratch->capacity * sizeof(GLfloat));
+    scratch->normals = realloc(scratch->normals, scratch->capacity * sizeof(GLfloat));
+    scratch->colors = realloc(scratch->colors, scratch->capacity * sizeof(GLfloat));
+}
+
+void freeMeshScratch(MeshScratch *scratch) {
+    free(scratch->points);
+    free(scratch->normals);
+    free(scratch->colors);
+    free(scratch->sorted);
+    free(scratch->slice_points);
+    free(scratch->slice_normals);
+    free(scratch->slice_colors);
+    *scratch = (MeshScratch){NULL, NULL, NULL, 0, NULL, NULL, NULL, NULL};
+}
+
+// works out the quads of the chunk without touching its mesh, so that it can be
+// done off the main thread. They're left in the scratch arrays, and the number
+// of elements in each of them is returned
+int buildChunkArrays(Chunk *chunk, MeshScratch *scratch) {
+    // 6 faces per cube * 4 vertices per face * 3 coordinates per vertex
+    unsigned int max_points;
+    unsigned int version;
+    ChunkRow dirty[6] = {0};
+    int tries = 0;
+    int size = 0;
+    int d;
+
+    // another thread may change the chunk while it's being meshed, in which case
+    // it's meshed again. A chunk that keeps changing is locked, so that meshing
+    // it finishes
+    do {
+        if (++tries == MAX_MESH_TRIES)
+            lockChunk(chunk);
+
+        version = beginChunkRead(chunk);
+
+        // the slices marked since the last try are meshed along with the ones the
+        // last try meshed, since those may have been meshed from a torn read
+        if (chunk->mesh_cache && useMeshing && !chunk->uniform) {
+            for (d = 0; d < 6; d++)
+                dirty[d] |= __atomic_exchange_n(&chunk->mesh_dirty[d], 0, __ATOMIC_RELAXED);
+
+            size = renderCachedChunk(chunk, dirty, scratch);
+            continue;
+        }
+
+        // a uniform chunk is either nothing or one big cube, which the mesher turns
+        // into 6 faces. Model blocks aren't in the mesh, they're drawn as instances
+        if (chunk->uniform)
+            max_points = (chunk->palette_size > 1) ? 6 * 4 * 3 : 0;
+        else
+            max_points = (chunk->num_active - chunk->num_models) * 6 * 4 * 3;
+
+        if (max_points == 0) {
+            size = 0;
+            continue;
+        }
+
+        reserveMeshScratch(scratch, max_points);
+
+        if (useMeshing || chunk->uniform)
+            size = renderChunkCubes(chunk, scratch, scratch->points, scratch->normals, scratch->colors, (vec3){0, 0, 0}, 1.0);
+        else
+            size = renderBlocksToArrays(chunk, scratch->points, scratch->normals, scratch->colors, (vec3){0, 0, 0}, 1.0, 0);
+    } while (chunkChanged(chunk, version));
+
+    if (tries >= MAX_MESH_TRIES)
+        unlockChunk(chunk);
+
+    return size;
+}
+
+// packs the arrays from buildChunkArrays into vertices, which are made to fit and
+// left NULL if there's nothing to draw. Returns the number of vertices
+int buildChunkVertices(Chunk *chunk, MeshScratch *scratch, PackedVertex **vertices) {
+    int num_vertices = buildChunkArrays(chunk, scratch) / 3;
+    int i, j, axis;
+
+    *vertices = NULL;
+
+    if (num_vertices == 0)
+        return 0;
+
+    *vertices = malloc(num_vertices * sizeof(PackedVertex));
+
+    for (i = 0; i < num_vertices; i++) {
+        GLfloat *p = &scratch->points[i * 3], *n = &scratch->normals[i * 3], *c = &scratch->colors[i * 3];
+        PackedVertex *v = &(*vertices)[i];
+
+        // rotated models leave a little rounding error in the normals, so the face
+        // is whichever axis the normal is closest to
+        axis = 0;
+
+        for (j = 1; j < 3; j++)
+            if (fabsf(n[j]) > fabsf(n[axis]))
+                axis = j;
+
+        for (j = 0; j < 3; j++) {
+            v->position[j] = (GLushort)(p[j] / PACKED_STEP + 0.5f);
+            v->color[j] = (GLubyte)(c[j] * 255 + 0.5f);
+        }
+
+        v->normal = axis * 2 + (n[axis] > 0);
+        v->color[3] = 255;
+    }
+
+    return num_vertices;
+}
+
+// replaces the chunk's mesh with the vertices from buildChunkVertices, which are
+// still the caller's to free
+void uploadChunkMesh(Chunk *chunk, PackedVertex *vertices, int num_vertices) {
+    // free the previously used buffers. Memory leaks are bad, mmkay.
+    if (chunk->mesh)
+        freeMesh(chunk->mesh);
+
+    // blocks may have been taken away since the box was last fit
+    fitChunkBounds(chunk);
+
+    // don't render an empty chunk :p. Its matrix is still needed to tell whether
+    // its model blocks are on screen
+    if (num_vertices == 0) {
+        *chunk->mesh = EMPTY_MESH;
+        identity_m4(chunk->mesh->modelMatrix);
+    } else {
+        buildPackedMesh(chunk->mesh, vertices, num_vertices);
+    }
+
+    // the vertices count in steps of PACKED_STEP
+    scale_m4(chunk->mesh->modelMatrix, PACKED_STEP);
+    translate_m4(chunk->mesh->modelMatrix,
+                 chunk->x * CHUNK_WIDTH,
+                 chunk->y * CHUNK_WIDTH,
+                 chunk->z * CHUNK_WIDTH);
+}
+
+void renderChunk(Chunk *chunk) {
+    PackedVertex *vertices;
+    int num_vertices = buildChunkVertices(chunk, &mainScratch, &vertices);
+
+    // this mesh is newer than any that are still being built on the mesh threads
+    chunk->mesh_shown = ++chunk->mesh_requests;
+
+    uploadChunkMesh(chunk, vertices, num_vertices);
+    updateChunkInstances(chunk);
+
+    free(vertices);
+}
+
+// a copy of the chunk for the mesh threads to work from, which the main thread
+// can go on changing the chunk under. The mesh only has the cubes, so the copy
+// only gets the colors and which blocks are cubes, and none of the models or
+// logic blocks
+Chunk *copyChunkForMeshing(Chunk *chunk) {
+    Chunk *copy = createChunk(chunk->x, chunk->y, chunk->z);
+    unsigned int row;
+
+    // the logic thread can't change the chunk halfway through
+    lockChunk(chunk);
+
+    free(copy->palette);
+    copy->palette_size = copy->palette_capacity = chunk->palette_size;
+    copy->palette = malloc(copy->palette_capacity * sizeof(Color));
+    memcpy(copy->palette, chunk->palette, copy->palette_size * sizeof(Color));
+
+    copy->uniform = chunk->uniform;
+    copy->index_bits = chunk->index_bits;
+
+    if (chunk->uniform) {
+        copy->indices = chunk->indices;
+        copy->num_active = chunk->num_active;
+    } else {
+        copy->indices = malloc(INDEX_WORDS(copy->index_bits) * sizeof(unsigned int));
+        memcpy(copy->indices, chunk->indices, INDEX_WORDS(copy->index_bits) * sizeof(unsigned int));
+
+        // the model blocks are left out, so that the copy is only cubes
+        copy->active_rows = malloc(CHUNK_ROWS * sizeof(ChunkRow));
+        for (row = 0; row < CHUNK_ROWS; row++)
+            copy->active_rows[row] = chunkCubeRow(chunk, row);
+
+        copy->num_active = chunk->num_active - chunk->num_models;
+    }
+
+    // the pieces of the chunk's mesh go with the copy, and are handed back with its
+    // mesh. The chunk starts marking its changes over from the copy
+    if (chunk->mesh_cache) {
+        copy->mesh_cache = chunk->mesh_cache;
+        chunk->mesh_cache = NULL;
+        memcpy(copy->mesh_dirty, chunk->mesh_dirty, sizeof(copy->mesh_dirty));
+        memset(chunk->mesh_dirty, 0, sizeof(chunk->mesh_dirty));
+    }
+
+    unlockChunk(chunk);
+
+    // the copy isn't in the world, so it takes the sides of the neighbors with it
+    memcpy(copy->borders, chunk->borders, sizeof(copy->borders));
+
+    return copy;
+}
+
+// a model block and the model it's an instance of, for sorting them by model
+typedef struct PlacedModel_S {
+    Model *model;
+    ModelInstance instance;
+} PlacedModel;
+
+static int comparePlacedModels(const void *a, const void *b) {
+    uintptr_t ma = (uintptr_t)((const PlacedModel*)a)->model;
+    uintptr_t mb = (uintptr_t)((const PlacedModel*)b)->model;
+
+    return (ma > mb) - (ma < mb);
+}
+
+// gathers the model blocks of the chunk into a group of instances per model, and
+// uploads them. Any model that needs rendering is rendered here, since only the
+// main thread can upload it
+void updateChunkInstances(Chunk *chunk) {
+    PlacedModel *placed;
+    ModelInstance *instances;
+    InstanceGroup *group = NULL;
+    BlockExtra *extra;
+    ChunkRow bits;
+    int row, x, i, n = 0;
+
+    chunk->instancesNeedUpdate = 0;
+    chunk->num_instance_groups = 0;
+
+    if (!chunkHasModels(chunk))
+        return;
+
+    placed = malloc(chunk->num_models * sizeof(PlacedModel));
+
+    // the logic thread can't swap the models of the logic blocks halfway through
+    lockChunk(chunk);
+
+    for (row = 0; row < CHUNK_ROWS; row++) {
+        for (bits = chunk->model_rows[row]; bits && n < chunk->num_models; bits &= bits - 1) {
+            x = rowLowestBit(bits);
+            extra = &chunk->extra[blockIndex(x, row >> LOG_CHUNK_SIZE, row & BLOCK_MASK)];
+
+            placed[n].model = extra->data;
+            placed[n].instance = (ModelInstance){
+                {x, row >> LOG_CHUNK_SIZE, row & BLOCK_MASK},
+                logicRotation(extra->logic)
+            };
+            n++;
+        }
+    }
+
+    unlockChunk(chunk);
+
+    qsort(placed, n, sizeof(PlacedModel), comparePlacedModels);
+
+    instances = malloc(n * sizeof(ModelInstance));
+    chunk->instance_groups = realloc(chunk->instance_groups, n * sizeof(InstanceGroup));
+
+    for (i = 0; i < n; i++) {
+        if (i == 0 || placed[i].model != placed[i - 1].model) {
+            if (placed[i].model->chunk->needsUpdate) {
+                renderModel(placed[i].model);
+                placed[i].model->chunk->needsUpdate = 0;
+            }
+
+            group = &chunk->instance_groups[chunk->num_instance_groups++];
+            *group = (InstanceGroup){placed[i].model, i, 0};
+        }
+
+        group->count++;
+        instances[i] = placed[i].instance;
+    }
+
+    buildInstanceBuffer(&chunk->instance_buffer, instances, n * sizeof(ModelInstance));
+
+    free(instances);
+    free(placed);
+}
+
+// the bytes a chunk takes up, not counting its mesh or models
+unsigned int chunkMemory(Chunk *chunk) {
+    unsigned int size = sizeof(Chunk) + chunk->palette_capacity * sizeof(Color);
+
+    // uniform chunks share their indices
+    if (!chunk->uniform)
+        size += INDEX_WORDS(chunk->index_bits) * sizeof(unsigned int) + CHUNK_ROWS * sizeof(ChunkRow);
+
+    if (chunk->extra)
+        size += BLOCKS_PER_CHUNK * sizeof(BlockExtra) + 2 * CHUNK_ROWS * sizeof(ChunkRow);
+
+    return size;
+}
+
+int countChunkSize(Chunk *chunk) {
+    ChunkRow bits;
+    int row, count;
+    Block block;
+
+    // plain cubes are all the same size
+    if (!chunkHasModels(chunk))
+        return chunk->num_active * 6 * 4 * 3;
+
+    count = (chunk->num_active - chunk->num_models) * 6 * 4 * 3;
+
+    for (row = 0; row < CHUNK_ROWS; row++) {
+        for (bits = chunk->model_rows[row]; bits; bits &= bits - 1) {
+            block = getBlock(chunk, rowLowestBit(bits), row >> LOG_CHUNK_SIZE, row & BLOCK_MASK);
+
+            // the logic thread may swap the model of a logic block while the
+            // chunk is meshed, so they're counted as their biggest model
+            if (block.logic)
+                count += logicModelSize(block.logic->type);
+            // models are copied in already rendered, so they know their size.
+            // Counting their blocks again gets slow once chunks are bigger than models
+            else if (block.data)
+                count += block.data->n_points;
+        }
+    }
+
+    return count;
+}
+
+// returns the number of elements added to the arrays
+int renderChunkToArrays(Chunk *chunk, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale) {
+    return renderBlocksToArrays(chunk, points, normals, colors, offset, scale, 1);
+}
+
+// the model blocks are left out unless models is set
+static int renderBlocksToArrays(Chunk *chunk, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale, int models) {
+    float blockWidth = BLOCK_WIDTH * scale;
+
+    Block block;
+    vec3 color;
+    int x, y, z;
+    float min_x, min_y, min_z, max_x, max_y, max_z;
+
+    GLfloat cube_vertices[8 * 3];
+
+    int points_index = 0;
 
     for (x = 0; x < CHUNK_SIZE; x++) {
+        min_x = x * blockWidth + offset[0];
+        max_x = min_x + blockWidth;
+
         for (y = 0; y < CHUNK_SIZE; y++) {
+            min_y = y * blockWidth + offset[1];
+            max_y = min_y + blockWidth;
+
             for (z = 0; z < CHUNK_SIZE; z++) {
-                if (getBlock(chunk, x, y, z)->logic)
-                    free(getBlock(chunk, x, y, z)->logic);
+                min_z = z * blockWidth + offset[2];
+                max_z = min_z + blockWidth;
+
+                block = getBlock(chunk, x, y, z);
+
+                if (!block.active) {
+                    continue;
+                }
+
+                // copies made for meshing only know which blocks are cubes
+                if (!models && !blockIsCube(chunk, blockIndex(x, y, z)))
+                    continue;
+
+                if (block.data) {
+                    if (block.data->chunk->needsUpdate) {
+                        renderModel(block.data);
+                        block.data->chunk->needsUpdate = 0;
+                    }
+
+                    points_index += addRenderedModel(
+                        block.data,
+                        &points[points_index],
+                        &normals[points_index],
+                        &colors[points_index],
+                        logicRotation(block.logic),
+                        (vec3){min_x, min_y, min_z},
+                        scale / MODEL_SIZE
+                    );
+                    continue;
+                }
+
+                cube_vertices[ 0] = min_x; cube_vertices[ 1] = min_y; cube_vertices[ 2] = min_z;
+                cube_vertices[ 3] = min_x; cube_vertices[ 4] = min_y; cube_vertices[ 5] = max_z;
+                cube_vertices[ 6] = min_x; cube_vertices[ 7] = max_y; cube_vertices[ 8] = min_z;
+                cube_vertices[ 9] = min_x; cube_vertices[10] = max_y; cube_vertices[11] = max_z;
+                cube_vertices[12] = max_x; cube_vertices[13] = min_y; cube_vertices[14] = min_z;
+                cube_vertices[15] = max_x; cube_vertices[16] = min_y; cube_vertices[17] = max_z;
+                cube_vertices[18] = max_x; cube_vertices[19] = max_y; cube_vertices[20] = min_z;
+                cube_vertices[21] = max_x; cube_vertices[22] = max_y; cube_vertices[23] = max_z;
+
+                color[0] = (float)block.color.r / 255.0;
+                color[1] = (float)block.color.g / 255.0;
+                color[2] = (float)block.color.b / 255.0;
+
+                // check if each face is visible
+                if ((x == CHUNK_SIZE - 1) ? !coveredByNeighbor(chunk, 1, x, y, z) : !blockIsCube(chunk, blockIndex(x+1, y, z))) {
+                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[ 0]);
+                    getFaceData(&normals[points_index],    &cubeNormals[5],    zeroIndices);
+                    getFaceData(&colors[points_index],     color,              zeroIndices);
+                    points_index += 4 * 3;
+                }
+
+                if ((y == CHUNK_SIZE - 1) ? !coveredByNeighbor(chunk, 3, x, y, z) : !blockIsCube(chunk, blockIndex(x, y+1, z))) {
+                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[ 4]);
+                    getFaceData(&normals[points_index],    &cubeNormals[4],    zeroIndices);
+                    getFaceData(&colors[points_index],     color,              zeroIndices);
+                    points_index += 4 * 3;
+                }
+
+                if ((z == CHUNK_SIZE - 1) ? !coveredByNeighbor(chunk, 5, x, y, z) : !blockIsCube(chunk, blockIndex(x, y, z+1))) {
+                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[ 8]);
+                    getFaceData(&normals[points_index],    &cubeNormals[3],    zeroIndices);
+                    getFaceData(&colors[points_index],     color,              zeroIndices);
+                    points_index += 4 * 3;
+                }
+
+                if ((x == 0) ? !coveredByNeighbor(chunk, 0, x, y, z) : !blockIsCube(chunk, blockIndex(x-1, y, z))) {
+                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[12]);
+                    getFaceData(&normals[points_index],    &cubeNormals[2],    zeroIndices);
+                    getFaceData(&colors[points_index],     color,              zeroIndices);
+                    points_index += 4 * 3;
+                }
+
+                if ((y == 0) ? !coveredByNeighbor(chunk, 2, x, y, z) : !blockIsCube(chunk, blockIndex(x, y-1, z))) {
+                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[16]);
+                    getFaceData(&normals[points_index],    &cubeNormals[1],    zeroIndices);
+                    getFaceData(&colors[points_index],     color,              zeroIndices);
+                    points_index += 4 * 3;
+                }
+
+                if ((z == 0) ? !coveredByNeighbor(chunk, 4, x, y, z) : !blockIsCube(chunk, blockIndex(x, y, z-1))) {
+                    getFaceData(&points[points_index],     cube_vertices,      &cubeIndices[20]);
+                    getFaceData(&normals[points_index],    &cubeNormals[0],    zeroIndices);
+                    getFaceData(&colors[points_index],     color,              zeroIndices);
+                    points_index += 4 * 3;
+                }
             }
         }
     }
 
-    freeMesh(chunk->mesh);
-    free(chunk->mesh);
-    free(chunk);
+    return points_index;
 }
 
-typedef struct BlockData_S {
-    unsigned short int logic:1;
-    unsigned short int data:1;
+// the quads of one slice of a chunk. Chunks that are edited a block at a time keep
+// their meshes in these pieces, so that an edit only has to mesh the slices it
+// changed, and the rest is copied back in
+typedef struct MeshPiece_S {
+    GLfloat *points, *normals, *colors;
+    int size;
+} MeshPiece;
+
+// one piece per layer of each direction, in the order the mesher draws them:
+// -x, +x, -y, +y, -z, +z. The chunk's mesh_dirty has the layers that have changed
+typedef struct ChunkMeshCache_S {
+    MeshPiece slices[6][CHUNK_SIZE];
+} ChunkMeshCache;
+
+static void freeMeshPiece(MeshPiece *piece) {
+    free(piece->points);
+    free(piece->normals);
+    free(piece->colors);
+    *piece = (MeshPiece){NULL, NULL, NULL, 0};
+}
 
-    unsigned short int logic_type:4;
-    unsigned short int logic_yaw:2;
-    unsigned short int logic_pitch:2;
-    unsigned short int logic_roll:2;
+static void setMeshPiece(MeshPiece *piece, GLfloat *points, GLfloat *normals, GLfloat *colors, int size) {
+    if (size == 0) {
+        freeMeshPiece(piece);
+        return;
+    }
 
-    Color color;
-} BlockData;
+    piece->points = realloc(piece->points, size * sizeof(GLfloat));
+    piece->normals = realloc(piece->normals, size * sizeof(GLfloat));
+    piece->colors = realloc(piece->colors, size * sizeof(GLfloat));
+    piece->size = size;
 
-typedef struct RLE_BlockData_S {
-    unsigned int count;
-    BlockData data;
-} RLE_BlockData;
+    memcpy(piece->points, points, size * sizeof(GLfloat));
+    memcpy(piece->normals, normals, size * sizeof(GLfloat));
+    memcpy(piece->colors, colors, size * sizeof(GLfloat));
+}
 
-void writeChunk(Chunk *chunk, FILE *out) {
-    RLE_BlockData buf = (RLE_BlockData){0};
-    BlockData data = (BlockData){0};
-    Block *block;
+static void freeMeshCache(ChunkMeshCache *cache) {
+    unsigned int d, i;
+
+    if (!cache)
+        return;
+
+    for (d = 0; d < 6; d++)
+        for (i = 0; i < CHUNK_SIZE; i++)
+            freeMeshPiece(&cache->slices[d][i]);
+
+    free(cache);
+}
+
+// every slice has to be meshed again, after the blocks were changed wholesale,
+// and so do the instances of the models
+static void dirtyAllSlices(Chunk *chunk) {
+    int d;
+
+    for (d = 0; d < 6; d++)
+        __atomic_store_n(&chunk->mesh_dirty[d], FULL_ROW, __ATOMIC_RELAXED);
+
+    chunk->instancesNeedUpdate = 1;
+}
+
+// the marks are taken without the lock, as the chunk is meshed, so they're atomic.
+// A block's faces are in the slices of its own layers, and it covers the faces
+// of the blocks on either side of it, which face it from the next layers over
+static void dirtyBlockSlices(Chunk *chunk, int x, int y, int z) {
+    int pos[3] = {x, y, z}, axis;
+    ChunkRow layer;
+
+    for (axis = 0; axis < 3; axis++) {
+        layer = (ChunkRow)1 << pos[axis];
+
+        __atomic_fetch_or(&chunk->mesh_dirty[axis * 2], layer | (ChunkRow)(layer << 1), __ATOMIC_RELAXED);
+        __atomic_fetch_or(&chunk->mesh_dirty[axis * 2 + 1], layer | (layer >> 1), __ATOMIC_RELAXED);
+    }
+}
+
+// chunks start keeping their mesh in pieces the first time a block is set in them,
+// unless a mesh thread has the pieces
+static void cacheChunkMesh(Chunk *chunk) {
+    if (chunk->mesh_cache || chunk->mesh_pending)
+        return;
+
+    chunk->mesh_cache = calloc(1, sizeof(ChunkMeshCache));
+    dirtyAllSlices(chunk);
+}
+
+// hands the pieces a mesh thread meshed the copy with back to the chunk. The chunk
+// has marked what was changed since the copy, so they pick up where they left off
+void keepMeshCache(Chunk *chunk, Chunk *copy) {
+    if (chunk->mesh_cache || !copy->mesh_cache)
+        return;
+
+    chunk->mesh_cache = copy->mesh_cache;
+    copy->mesh_cache = NULL;
+}
+
+// a face is visible where a cube isn't covered by the next cube along the axis,
+// or on the side of the chunk, by the neighbor's cube in border.
+// Rows run along x, so for x this is a shift within the row
+static void findVisibleFaces(const ChunkRow *cubes, const ChunkRow *border, ChunkRow *visible, int axis1, int sign) {
+    int pos[3], dir[3] = {0, 0, 0};
+    ChunkRow side = (ChunkRow)1 << ((sign > 0) ? CHUNK_SIZE - 1 : 0);
+    unsigned int row;
+
+    dir[axis1] = sign;
+
+    for (pos[1] = 0; pos[1] < CHUNK_SIZE; pos[1]++) {
+        for (pos[2] = 0; pos[2] < CHUNK_SIZE; pos[2]++) {
+            row = rowIndex(pos[1], pos[2]);
+
+            if (axis1 == 0)
+                visible[row] = cubes[row] & ~((sign > 0) ? (cubes[row] >> 1) : (cubes[row] << 1)) &
+                               ~(((border[pos[2]] >> pos[1]) & 1) ? side : 0);
+            else if (((sign > 0) ? (pos[axis1] < CHUNK_SIZE - 1) : (pos[axis1] > 0)))
+                visible[row] = cubes[row] & ~cubes[rowIndex(pos[1] + dir[1], pos[2] + dir[2])];
+            else
+                visible[row] = cubes[row] & ~border[(axis1 == 2) ? pos[1] : pos[2]];
+        }
+    }
+}
+
+// adds a w by h rectangle of faces, from (i, j) along axis2 and axis3 of the
+// slice at pos along axis1. Returns the number of elements added to the arrays
+static int addSliceFace(GLfloat *points, GLfloat *normals, GLfloat *colors, const Color *faceColor,
+                        int axis1, int sign, int pos, int i, int j, int w, int h, float blockWidth, vec3 offset) {
+    int axis2 = (axis1 + 1) % 3;
+    int axis3 = (axis1 + 2) % 3;
+
+    vec3 color, fpos;
+    vec3 d_axis2 = {0, 0, 0}, d_axis3 = {0, 0, 0};
+    GLuint indices[] = {0, 1, 2, 3, 0, 3, 2, 1};
+    GLfloat verts[12];
+
+    color[0] = (float)faceColor->r / 255.0;
+    color[1] = (float)faceColor->g / 255.0;
+    color[2] = (float)faceColor->b / 255.0;
+
+    fpos[axis1] = pos * blockWidth + offset[axis1];
+    fpos[axis2] = i * blockWidth + offset[axis2];
+    fpos[axis3] = j * blockWidth + offset[axis3];
+
+    d_axis2[axis2] = w * blockWidth;
+    d_axis3[axis3] = h * blockWidth;
+
+    if (sign > 0) fpos[axis1] += blockWidth;
+
+    verts[ 0] = fpos[0];
+    verts[ 1] = fpos[1];
+    verts[ 2] = fpos[2];
+    verts[ 3] = fpos[0] + d_axis2[0];
+    verts[ 4] = fpos[1] + d_axis2[1];
+    verts[ 5] = fpos[2] + d_axis2[2];
+    verts[ 6] = fpos[0] + d_axis2[0] + d_axis3[0];
+    verts[ 7] = fpos[1] + d_axis2[1] + d_axis3[1];
+    verts[ 8] = fpos[2] + d_axis2[2] + d_axis3[2];
+    verts[ 9] = fpos[0] + d_axis3[0];
+    verts[10] = fpos[1] + d_axis3[1];
+    verts[11] = fpos[2] + d_axis3[2];
+
+    getFaceData(points, verts, &indices[((sign < 0) ? 4 : 0)]);
+    getFaceData(normals, &cubeNormals[(sign > 0) ? 5-axis1 : 2-axis1], zeroIndices);
+    getFaceData(colors, color, zeroIndices);
+
+    return 12;
+}
+
+// models are drawn after the cubes, rotated and scaled down into their blocks
+static int renderChunkModels(Chunk *chunk, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale) {
+    float blockWidth = scale * BLOCK_WIDTH;
+    unsigned int points_index = 0, pos[3];
+    Block voxel;
+
+    for (pos[0] = 0; pos[0] < CHUNK_SIZE; pos[0]++) {
+        for (pos[1] = 0; pos[1] < CHUNK_SIZE; pos[1]++) {
+            for (pos[2] = 0; pos[2] < CHUNK_SIZE; pos[2]++) {
+                if (!(chunk->model_rows[rowIndex(pos[1], pos[2])] & ((ChunkRow)1 << pos[0])))
+                    continue;
+
+                voxel = getBlock(chunk, pos[0], pos[1], pos[2]);
+
+                if (voxel.active && voxel.data) {
+                    if (voxel.data->chunk->needsUpdate) {
+                        renderModel(voxel.data);
+                        voxel.data->chunk->needsUpdate = 0;
+                    }
+
+                    points_index += addRenderedModel(
+                            voxel.data, &points[points_index], &normals[points_index], &colors[points_index], logicRotation(voxel.logic),
+                            (vec3){pos[0]*blockWidth + offset[0], pos[1]*blockWidth + offset[1], pos[2]*blockWidth + offset[2]},
+                            scale / MODEL_SIZE
+                        );
+                }
+            }
+        }
+    }
+
+    return points_index;
+}
 
-    for (int i=0; i < CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE; i++) {
-        block = &chunk->blocks_lin[i];
+int renderChunkWithMeshing(Chunk *chunk, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale) {
+    float blockWidth = scale * BLOCK_WIDTH;
+
+    PaletteIndex face[CHUNK_SIZE][CHUNK_SIZE];
+    ChunkRow cubes[CHUNK_ROWS], visible[CHUNK_ROWS];
+    unsigned int axis1, axis2, axis3, w, h, i, j, k, points_index, pos[3], row;
+    int sign, empty, models;
+
+    //Color covered; // placeholder value for covered faces
+
+    /*
+        axis1 is our "working" axis. We look at both sides of each "slice" of the chunk
+        along that axis, and determine whether each face is visible by checking
+        the block in front of it. For each face that is visible, its color is
+        added to the face array. Then we look at the face array and split it up
+        into rectangles of the same color using a greedy algorithm. We draw each
+        rectangle and then move on to the next axis.
+
+
+        // ***** this is currently removed *****
+        I also implemented (my own idea!) a system where if a block is covered,
+        a placeholder value is inserted in the face array instead. Then, when
+        calculating the rectangles, the placeholder value is treated as a solid
+        block, except for the fact that a rectangle cannot start on a face with
+        the placeholder value. This still prevents faces that are completely
+        hidden from being drawn, but allows for rectangles to be combined under
+        blocks that are hiding different colors. This should result in a strictly
+        smaller number of rectangles being drawn, at near-zero cost :D
+        The only drawback is that large rectangles that are mostly hidden may
+        still be drawn. Everything will still look fine, but there is a little
+        extra cost from drawing the overlapping triangles. My hope is that
+        overall the scene will render even faster.
+    */
+
+    memset(face, 0, sizeof(face));
+
+    points_index = 0;
+    models = 0;
+
+    // models have to be handled separately, after the cubes
+    models = chunkHasModels(chunk);
+
+    for (row = 0; row < CHUNK_ROWS; row++)
+        cubes[row] = chunkCubeRow(chunk, row);
+
+    for (axis1 = 0; axis1 < 3; axis1++) {
+        axis2 = (axis1 + 1) % 3;
+        axis3 = (axis1 + 2) % 3;
+
+        for (sign = -1; sign < 2; sign += 2) {
+            findVisibleFaces(cubes, chunk->borders[axis1 * 2 + (sign > 0)], visible, axis1, sign);
+
+            for (pos[axis1] = 0; pos[axis1] < CHUNK_SIZE; pos[axis1]++) {
+                empty = 1;
+
+                // generate the face array
+                for (pos[axis2] = 0; pos[axis2] < CHUNK_SIZE; pos[axis2]++) {
+                    for (pos[axis3] = 0; pos[axis3] < CHUNK_SIZE; pos[axis3]++) {
+                        if (visible[rowIndex(pos[1], pos[2])] & ((ChunkRow)1 << pos[0])) {
+                            empty = 0;
+                            face[pos[axis3]][pos[axis2]] = blockPaletteIndex(chunk, blockIndex(pos[0], pos[1], pos[2]));
+                        }
+                    }
+                }
+
+                // nothing to do here. Continue on.
+                if (empty)
+                    continue;
+
+                /*puts("---------------");
+                printf("____%c%c AXIS____\n", sign > 0 ? '+' : '-', (char[]){'X','Y','Z'}[axis1]);
+                printf("___SLICE #%02d___\n", pos[axis1]);
+                for (i = 0; i < CHUNK_SIZE; i++) {
+                    for (j = 0; j < CHUNK_SIZE; j++) {
+                        printf("%c ", face[j][i] ? '#' : ' ');
+                    }
+                    puts("");
+                }
+                puts("---------------\n");*/
+
+                // cut the face up into rectangles and draw them
+                for (j = 0; j < CHUNK_SIZE; j++) {
+                    for (i = 0; i < CHUNK_SIZE;) {
+                        w = 1;
+
+                        if (face[j][i]) {
+
+                            // get the width
+                            while (
+                                (i + w < CHUNK_SIZE) &&
+                                (face[j][i + w] == face[j][i])
+                            ) w++;
+
+                            // get the height
+                            for (h = 1; j + h < CHUNK_SIZE; h++) {
+
+                                // we look at the next row, and make sure each
+                                // block on the face is solid and the same color.
+                                // if it's not, we break from the outer loop
+                                for (k = 0; k < w; k++) {
+                                    if (face[j + h][i + k] != face[j][i])
+                                        goto done;
+                                }
+                            }
+                            done:
+
+                            // draw it
+                            points_index += addSliceFace(&points[points_index], &normals[points_index], &colors[points_index],
+                                                         &chunk->palette[face[j][i]], axis1, sign, pos[axis1], i, j, w, h,
+                                                         blockWidth, offset);
+
+                            // empty the face array wherever we rendered it
+                            for(k = 0; k < h; k++) {
+                                memset(&face[j + k][i], 0, w * sizeof(face[0][0]));
+                            }
+                        }
+
+                        i += w;
+                    }
+                }
+            }
+        }
+    }
+
+    // there were models in the chunk. Render them
+    if (models)
+        points_index += renderChunkModels(chunk, &points[points_index], &normals[points_index], &colors[points_index], offset, scale);
+
+    return points_index;
+}
+
+// the visible faces of one direction, sorted into a line of bits per (slice, j),
+// along with which faces are the same color as the one before them on the line,
+// and the color of each face
+typedef struct SliceFaces_S {
+    ChunkRow faces[CHUNK_ROWS], same[CHUNK_ROWS];
+    PaletteIndex face[BLOCKS_PER_CHUNK];
+} SliceFaces;
+
+// the largest number of elements a slice can add, if every face is its own rectangle
+#define MAX_SLICE_POINTS (CHUNK_ROWS * 4 * 3)
+
+// these are the same size for every chunk, so they're allocated once and kept
+static void reserveSliceScratch(MeshScratch *scratch) {
+    if (scratch->sorted)
+        return;
+
+    scratch->sorted = malloc(sizeof(SliceFaces));
+    scratch->slice_points = malloc(MAX_SLICE_POINTS * sizeof(GLfloat));
+    scratch->slice_normals = malloc(MAX_SLICE_POINTS * sizeof(GLfloat));
+    scratch->slice_colors = malloc(MAX_SLICE_POINTS * sizeof(GLfloat));
+}
+
+// meshes the slices of one direction that are set in layers. Each slice goes into
+// its own piece if pieces is given, using the scratch's slice arrays as room for
+// one slice, and otherwise they all go into the arrays one after another
+static int meshSlices(Chunk *chunk, const ChunkRow *cubes, MeshScratch *scratch, int axis1, int sign, ChunkRow layers,
+                      GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale, MeshPiece *pieces) {
+    SliceFaces *sorted = scratch->sorted;
+    float blockWidth = scale * BLOCK_WIDTH;
+
+    ChunkRow visible[CHUNK_ROWS];
+    ChunkRow run, span, links, bits;
+    unsigned int axis2, axis3, slice, w, h, i, j, line, points_index, pos[3];
+    PaletteIndex color;
+
+    ChunkRow *faces = sorted->faces, *same = sorted->same;
+    PaletteIndex *face = sorted->face;
+
+    if (pieces) {
+        points = scratch->slice_points;
+        normals = scratch->slice_normals;
+        colors = scratch->slice_colors;
+    }
+
+    axis2 = (axis1 + 1) % 3;
+    axis3 = (axis1 + 2) % 3;
+
+    findVisibleFaces(cubes, chunk->borders[axis1 * 2 + (sign > 0)], visible, axis1, sign);
+
+    memset(faces, 0, CHUNK_ROWS * sizeof(ChunkRow));
+
+    // sort the visible faces into the lines of their slices
+    for (pos[1] = 0; pos[1] < CHUNK_SIZE; pos[1]++) {
+        for (pos[2] = 0; pos[2] < CHUNK_SIZE; pos[2]++) {
+            bits = visible[rowIndex(pos[1], pos[2])];
+
+            // rows run along x, so the layers can be picked out of them directly
+            if (axis1 == 0)
+                bits &= layers;
+            else if (!(layers & ((ChunkRow)1 << pos[axis1])))
+                continue;
+
+            for (; bits; bits &= bits - 1) {
+                pos[0] = rowLowestBit(bits);
+                line = pos[axis1] * CHUNK_SIZE + pos[axis3];
+
+                faces[line] |= (ChunkRow)1 << pos[axis2];
+                face[line * CHUNK_SIZE + pos[axis2]] = blockPaletteIndex(chunk, blockIndex(pos[0], pos[1], pos[2]));
+            }
+        }
+    }
+
+    // link each face to the one before it, if they're the same color
+    for (line = 0; line < CHUNK_ROWS; line++) {
+        same[line] = 0;
+
+        for (bits = faces[line] & (faces[line] << 1); bits; bits &= bits - 1) {
+            i = rowLowestBit(bits);
+
+            if (face[line * CHUNK_SIZE + i] == face[line * CHUNK_SIZE + i - 1])
+                same[line] |= (ChunkRow)1 << i;
+        }
+    }
+
+    points_index = 0;
+
+    // cut each slice up into rectangles and draw them
+    for (slice = 0; slice < CHUNK_SIZE; slice++) {
+        if (!(layers & ((ChunkRow)1 << slice)))
+            continue;
+
+        for (j = 0; j < CHUNK_SIZE; j++) {
+            line = slice * CHUNK_SIZE + j;
+
+            while (faces[line]) {
+                i = rowLowestBit(faces[line]);
+                color = face[line * CHUNK_SIZE + i];
+
+                // the faces after i that are still there and linked to the one before them.
+                // Shifting twice keeps the shift narrower than the row
+                run = ((same[line] & faces[line]) >> i) >> 1;
+                w = 1 + rowLowestBit((ChunkRow)~run);
+
+                span = ((w == CHUNK_SIZE) ? FULL_ROW : (ChunkRow)(((ChunkRow)1 << w) - 1)) << i;
+                links = span & ~((ChunkRow)1 << i);
+
+                for (h = 1; j + h < CHUNK_SIZE; h++) {
+                    if ((faces[line + h] & span) != span || (same[line + h] & links) != links ||
+                        face[(line + h) * CHUNK_SIZE + i] != color)
+                        break;
+
+                    faces[line + h] &= ~span;
+                }
+
+                faces[line] &= ~span;
+
+                points_index += addSliceFace(&points[points_index], &normals[points_index], &colors[points_index],
+                                             &chunk->palette[color], axis1, sign, slice, i, j, w, h,
+                                             blockWidth, offset);
+            }
+        }
+
+        if (pieces) {
+            setMeshPiece(&pieces[slice], points, normals, colors, points_index);
+            points_index = 0;
+        }
+    }
+
+    return points_index;
+}
+
+// the same rectangles as renderChunkWithMeshing, in the same order, but found a row
+// of bits at a time. The visible faces of each slice are gathered into a row of bits
+// per line, along with a row of which faces are the same color as the one before
+// them. The rectangles then come from bit scans, instead of comparing colors face by
+// face: a rectangle runs along its line as far as the faces stay linked, and down
+// onto each next line that still has all of those faces, linked, in the same color
+int renderChunkWithBinaryMeshing(Chunk *chunk, MeshScratch *scratch, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale) {
+    int points_index = renderChunkCubes(chunk, scratch, points, normals, colors, offset, scale);
+
+    if (chunkHasModels(chunk))
+        points_index += renderChunkModels(chunk, &points[points_index], &normals[points_index], &colors[points_index], offset, scale);
+
+    return points_index;
+}
+
+// the cubes of renderChunkWithBinaryMeshing, without the models. A chunk in the
+// world is meshed like this, and its model blocks are drawn as instances
+int renderChunkCubes(Chunk *chunk, MeshScratch *scratch, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale) {
+    ChunkRow cubes[CHUNK_ROWS];
+    unsigned int axis1, points_index, row;
+    int sign;
+
+    reserveSliceScratch(scratch);
+    points_index = 0;
+
+    for (row = 0; row < CHUNK_ROWS; row++)
+        cubes[row] = chunkCubeRow(chunk, row);
+
+    for (axis1 = 0; axis1 < 3; axis1++) {
+        for (sign = -1; sign < 2; sign += 2) {
+            points_index += meshSlices(chunk, cubes, scratch, axis1, sign, FULL_ROW,
+                                       &points[points_index], &normals[points_index], &colors[points_index],
+                                       offset, scale, NULL);
+        }
+    }
+
+    return points_index;
+}
+
+// the same quads as renderChunkCubes, but only the slices in dirty are meshed, and
+// the rest comes from the chunk's pieces. The scratch arrays are grown to fit, and
+// the number of elements in them returned
+static int renderCachedChunk(Chunk *chunk, const ChunkRow *dirty, MeshScratch *scratch) {
+    ChunkMeshCache *cache = chunk->mesh_cache;
+    ChunkRow cubes[CHUNK_ROWS];
+    MeshPiece *piece;
+    unsigned int d, i, row;
+    int size = 0, sorted = 0;
+
+    for (d = 0; d < 6; d++) {
+        if (!dirty[d])
+            continue;
+
+        if (!sorted) {
+            for (row = 0; row < CHUNK_ROWS; row++)
+                cubes[row] = chunkCubeRow(chunk, row);
+
+            reserveSliceScratch(scratch);
+            sorted = 1;
+        }
+
+        meshSlices(chunk, cubes, scratch, d / 2, (d & 1) ? 1 : -1, dirty[d],
+                   NULL, NULL, NULL, (vec3){0, 0, 0}, 1.0, cache->slices[d]);
+    }
+
+    for (d = 0; d < 6; d++)
+        for (i = 0; i < CHUNK_SIZE; i++)
+            size += cache->slices[d][i].size;
+
+    if (size == 0)
+        return 0;
+
+    reserveMeshScratch(scratch, size);
+    size = 0;
+
+    for (i = 0; i < 6 * CHUNK_SIZE; i++) {
+        piece = &cache->slices[i / CHUNK_SIZE][i % CHUNK_SIZE];
+
+        if (piece->size == 0)
+            continue;
+
+        memcpy(&scratch->points[size], piece->points, piece->size * sizeof(GLfloat));
+        memcpy(&scratch->normals[size], piece->normals, piece->size * sizeof(GLfloat));
+        memcpy(&scratch->colors[size], piece->colors, piece->size * sizeof(GLfloat));
+        size += piece->size;
+    }
+
+    return size;
+}
+
+void freeChunk(Chunk *chunk) {
+    // meshes still being built for it have nowhere to go
+    if (chunk->mesh_pending)
+        cancelChunkMeshes(chunk);
+
+    freeChunkExtra(chunk);
+    freeMeshCache(chunk->mesh_cache);
+    freeInstanceBuffer(&chunk->instance_buffer);
+    free(chunk->instance_groups);
+
+    free(chunk->palette);
+    free(chunk->active_rows);
+    if (!chunk->uniform)
+        free(chunk->indices);
+
+    freeMesh(chunk->mesh);
+    free(chunk->mesh);
+    poolFree(&chunkPool, chunk);
+}
+
+typedef struct BlockData_S {
+    unsigned short int logic:1;
+    unsigned short int data:1;
+
+    unsigned short int logic_type:4;
+    unsigned short int logic_yaw:2;
+    unsigned short int logic_pitch:2;
+    unsigned short int logic_roll:2;
+
+    Color color;
+} BlockData;
+
+typedef struct RLE_BlockData_S {
+    unsigned int count;
+    BlockData data;
+} RLE_BlockData;
+
+// writes the blocks of part p of the chunk
+static void writePart(Chunk *chunk, FILE *out, int p) {
+    RLE_BlockData buf = (RLE_BlockData){0};
+    BlockData data = (BlockData){0};
+    Block block;
+
+    // the whole part is a single run
+    if (chunk->uniform) {
+        buf.count = BLOCKS_PER_PART;
+        buf.data.color = chunk->palette[chunk->palette_size - 1];
+        fwrite(&buf, sizeof(buf), 1, out);
+        return;
+    }
+
+    for (int i=0; i < BLOCKS_PER_PART; i++) {
+        block = chunkBlock(chunk, fileIndex(i, p));
+
+        data.logic = !!(block.logic);
+        data.data = !data.logic && block.data;
+        if (data.logic) {
+            data.logic_type = block.logic->type;
+            data.logic_roll = block.logic->roll;
+            data.logic_pitch = block.logic->pitch;
+            data.logic_yaw = block.logic->yaw;
+        }
+        data.color = block.color;
+
+        char equal = data.logic == buf.data.logic && data.data == !!buf.data.data &&
+                     (!data.logic || (data.logic_type == buf.data.logic_type && data.logic_roll == buf.data.logic_roll &&
+                       data.logic_pitch == buf.data.logic_pitch && data.logic_yaw == buf.data.logic_yaw)) &&
+                     data.color.all == buf.data.color.all && !data.data;
+
+        if (equal) {
+            buf.count++;
+        } else {
+            if (buf.count)
+                fwrite(&buf, sizeof(RLE_BlockData), 1, out);
+
+            buf.count = 1;
+            buf.data = data;
+
+            if (data.data) {
+                fwrite(&buf, sizeof(buf), 1, out);
+                buf.count = 0;
+                buf.data = (BlockData){0};
+                writeChunk(block.data->chunk, out);
+            }
+        }
+
+        data = (BlockData){0};
+    }
+
+    if (buf.count) fwrite(&buf, sizeof(buf), 1, out);
+}
+
+// models, and the chunks of worlds built with 16 block chunks, are a single part
+void writeChunk(Chunk *chunk, FILE *out) {
+    writePart(chunk, out, 0);
+}
+
+static int partIsEmpty(Chunk *chunk, int p) {
+    int y, z;
+    ChunkRow span;
+
+    if (chunk->uniform)
+        return chunk->palette_size == 1;
+
+    span = (ChunkRow)(FULL_ROW >> (CHUNK_SIZE - MODEL_SIZE)) << (partX(p) * MODEL_SIZE);
+
+    for (y = partY(p) * MODEL_SIZE; y < (partY(p) + 1) * MODEL_SIZE; y++) {
+        for (z = partZ(p) * MODEL_SIZE; z < (partZ(p) + 1) * MODEL_SIZE; z++) {
+            if (chunk->active_rows[rowIndex(y, z)] & span)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+// worlds start with their size. The original format then has all size^3 chunks
+// in order. Sparse worlds have SPARSE_WORLD in place of the size, followed by
+// the size, the number of chunks, a directory of where each chunk's blocks
+// are in the file, and then the blocks. Chunks in files are always 16 blocks
+// wide, so with bigger chunks each of them is one part of a chunk in memory
+#define SPARSE_WORLD 0
+
+typedef struct ChunkEntry_S {
+    int x, y, z;
+    unsigned int offset, length;
+} ChunkEntry;
+
+static void copyBytes(FILE *out, FILE *in, long offset, unsigned int length) {
+    char buf[4096];
+    size_t size;
+
+    fseek(in, offset, SEEK_SET);
+
+    while (length && (size = fread(buf, 1, (length < sizeof(buf)) ? length : sizeof(buf), in))) {
+        fwrite(buf, 1, size, out);
+        length -= size;
+    }
+}
+
+void writeWorld(World *world, char *file_path) {
+    // a streamed world may still be reading from the file it is saved over,
+    // so the new one is written next to it and moved over it at the end
+    char *temp_path = malloc(strlen(file_path) + 5);
+    unsigned int header[3] = {SPARSE_WORLD, world->size << LOG_PARTS, 0};
+    WorldStream *stream = world->stream;
+    ChunkLocation *location;
+    ChunkEntry *entries, *entry;
+    Chunk *chunk;
+    FILE *out;
+    long offset;
+    int i, p;
+
+    sprintf(temp_path, "%s.tmp", file_path);
+    out = fopen(temp_path, "wb");
+
+    if (!out) {
+        fprintf(stderr, "Error writing %s: file not found\n", file_path);
+        free(temp_path);
+        return;
+    }
+
+    // empty parts are left out, along with the ones that are loaded
+    // and so are written from memory rather than copied from the file
+    for (i = 0; i < world->num_chunks; i++) {
+        for (p = 0; p < PARTS_PER_CHUNK; p++)
+            header[2] += !partIsEmpty(world->chunks[i], p);
+    }
+
+    for (i = 0; stream && i < stream->num_slots; i++) {
+        location = &stream->locations[i];
+
+        if (location->used && !worldChunk(world, location->x, location->y, location->z)) {
+            for (p = 0; p < PARTS_PER_CHUNK; p++)
+                header[2] += !!location->parts[p].length;
+        }
+    }
+
+    entries = calloc(header[2] + 1, sizeof(ChunkEntry));
+    entry = entries;
+
+    fwrite(header, sizeof(header), 1, out);
+    fwrite(entries, sizeof(ChunkEntry), header[2], out);
+
+    for (i = 0; i < world->num_chunks; i++) {
+        chunk = world->chunks[i];
+
+        for (p = 0; p < PARTS_PER_CHUNK; p++) {
+            if (!partIsEmpty(chunk, p)) {
+                *entry = (ChunkEntry){partCoord(chunk->x, partX(p)), partCoord(chunk->y, partY(p)), partCoord(chunk->z, partZ(p)), ftell(out), 0};
+                writePart(chunk, out, p);
+                entry->length = ftell(out) - entry->offset;
+                entry++;
+            }
+        }
+    }
+
+    for (i = 0; stream && i < stream->num_slots; i++) {
+        location = &stream->locations[i];
+
+        if (!location->used || worldChunk(world, location->x, location->y, location->z))
+            continue;
+
+        for (p = 0; p < PARTS_PER_CHUNK; p++) {
+            if (location->parts[p].length) {
+                *entry = (ChunkEntry){partCoord(location->x, partX(p)), partCoord(location->y, partY(p)), partCoord(location->z, partZ(p)),
+                                      ftell(out), location->parts[p].length};
+                copyBytes(out, location->parts[p].swapped ? stream->swap : stream->file,
+                          location->parts[p].offset, location->parts[p].length);
+                entry++;
+            }
+        }
+    }
+
+    // the directory only has room for 32 bit offsets. The world being saved over
+    // is left as it was
+    offset = ftell(out);
+
+    if (offset < 0 || (unsigned long)offset > UINT_MAX) {
+        fprintf(stderr, "Error writing %s: world is bigger than 4 GiB\n", file_path);
+        fclose(out);
+        remove(temp_path);
+        free(entries);
+        free(temp_path);
+        return;
+    }
+
+    fseek(out, sizeof(header), SEEK_SET);
+    fwrite(entries, sizeof(ChunkEntry), header[2], out);
+
+    fclose(out);
+    rename(temp_path, file_path);
+
+    free(entries);
+    free(temp_path);
+}
+
+// reads part p of a chunk. The chunk isn't meshed until finishChunk
+static char readPart(Chunk *chunk, FILE *in, int p) {
+    RLE_BlockData buf;
+    BlockData data;
+    int count = 0, size, i = 0, j;
+    unsigned int index;
+    Block block;
+
+    while (count < BLOCKS_PER_PART) {
+        size = fread(&buf, sizeof(buf), 1, in);
+
+        if (!size) { // file too short
+            fprintf(stderr, "Error reading world file");
+            if (feof(in)) fputs("; file too short", stderr);
+            else if (ferror(in)) fputs("; an error occured", stderr);
+            fputs("\n", stderr);
+            return 0;
+        }
+
+        // printf("read %d blocks\n", buf.count);
+
+        count += buf.count;
+        data = buf.data;
+
+        // the whole run shares one palette entry
+        index = paletteIndex(chunk, data.color);
+
+        // runs of the color a uniform chunk already has don't need to be written
+        if (chunk->uniform && (index != blockPaletteIndex(chunk, 0) || data.logic || data.data))
+            promoteChunk(chunk);
+
+        while (buf.count > 0 && i < BLOCKS_PER_PART) {
+            j = fileIndex(i, p);
+
+            if (!chunk->uniform) {
+                setPaletteIndex(chunk, j, index);
+                setRowBit(chunk->active_rows, j, index || data.data);
+            }
+
+            if (data.logic || data.data) {
+                block = EMPTY_BLOCK;
+
+                if (data.logic) {
+                    // blocks that were saved keep the orientation they were saved with
+                    block.logic = createLogic();
+                    block.logic->auto_orient = 0;
+
+                    block.logic->type = data.logic_type;
+                    block.logic->roll = data.logic_roll;
+                    block.logic->pitch = data.logic_pitch;
+                    block.logic->yaw = data.logic_yaw;
+
+                    updateLogicModel(&block);
+                }
+
+                if (data.data) {
+                    block.data = createModel();
+                    if (!readChunk(block.data->chunk, in))
+                        return 0;
+                    renderModel(block.data);
+                }
+
+                storeBlockData(chunk, j, &block);
+            }
+
+            i++;
+            buf.count--;
+        }
+    }
+
+    return 1;
+}
+
+static void prepareChunk(Chunk *chunk) {
+    countChunk(chunk);
+    demoteChunk(chunk);
+    updateChunkNode(chunk);
+    updateBorders(chunk);
+}
+
+static void finishChunk(Chunk *chunk) {
+    prepareChunk(chunk);
+    renderChunk(chunk);
+}
+
+char readChunk(Chunk *chunk, FILE *in) {
+    if (!readPart(chunk, in, 0))
+        return 0;
+
+    finishChunk(chunk);
+
+    return 1;
+}
+
+World *readWorld(char *file_path) {
+    FILE *in = fopen(file_path, "rb");
+
+    if (!in) {
+        fprintf(stderr, "Error reading %s: file not found\n", file_path);
+        return NULL;
+    }
+
+    unsigned int size, num_chunks, i;
+    int x, y, z;
+    ChunkEntry *entries, *entry;
+    Chunk *chunk;
+    World *world;
+
+    fread(&size, sizeof(size), 1, in);
+
+    // coordinates in the file are in parts, which are the same as chunks
+    // unless chunks are bigger than models
+    if (size == SPARSE_WORLD) {
+        fread(&size, sizeof(size), 1, in);
+        fread(&num_chunks, sizeof(num_chunks), 1, in);
+
+        world = createWorld((size + PART_MASK) >> LOG_PARTS);
+        entries = malloc((num_chunks + 1) * sizeof(ChunkEntry));
+
+        if (fread(entries, sizeof(ChunkEntry), num_chunks, in) != num_chunks) {
+            fprintf(stderr, "Error reading world file; file too short\n");
+            num_chunks = 0;
+        }
+
+        for (i = 0; i < num_chunks; i++) {
+            entry = &entries[i];
+            fseek(in, entry->offset, SEEK_SET);
+            chunk = addChunk(world, entry->x >> LOG_PARTS, entry->y >> LOG_PARTS, entry->z >> LOG_PARTS);
+
+            if (!readPart(chunk, in, partIndex(entry->x, entry->y, entry->z)))
+                break;
+        }
+
+        free(entries);
+
+        if (i < num_chunks) {
+            freeWorld(world);
+            fclose(in);
+            return NULL;
+        }
+    } else {
+        world = createWorld((size + PART_MASK) >> LOG_PARTS);
+
+        for (x = 0; x < size; x++) {
+            for (y = 0; y < size; y++) {
+                for (z = 0; z < size; z++) {
+                    chunk = addChunk(world, x >> LOG_PARTS, y >> LOG_PARTS, z >> LOG_PARTS);
+
+                    if (!readPart(chunk, in, partIndex(x, y, z))) {
+                        freeWorld(world);
+                        fclose(in);
+                        return NULL;
+                    }
+                }
+            }
+        }
+    }
+
+    fclose(in);
+
+    // only keep the chunks that have something in them. Going backwards,
+    // since removing a chunk moves the last one in its place
+    for (i = world->num_chunks; i-- > 0;) {
+        chunk = world->chunks[i];
+
+        if (chunkIsEmpty(chunk)) {
+            removeChunk(world, chunk->x, chunk->y, chunk->z);
+            freeChunk(chunk);
+        }
+    }
+
+    // every chunk is read before any of them is meshed, so that they're meshed
+    // against their neighbors' sides. That makes them all up to date
+    for (i = 0; i < world->num_chunks; i++)
+        prepareChunk(world->chunks[i]);
+
+    for (i = 0; i < world->num_chunks; i++) {
+        renderChunk(world->chunks[i]);
+        world->chunks[i]->needsUpdate = 0;
+    }
+
+    return world;
+}
+
+// octree
+
+// which child of a node at level the chunk (x, y, z) is in
+#define childIndex(level, x, y, z) (((((x) + NODE_BIAS) >> ((level) - 1)) & 1) << 2 | \
+                                    ((((y) + NODE_BIAS) >> ((level) - 1)) & 1) << 1 | \
+                                     ((((z) + NODE_BIAS) >> ((level) - 1)) & 1))
+
+#define nodeContains(node, cx, cy, cz) ((((cx) + NODE_BIAS) >> (node)->level) == (node)->x && \
+                                        (((cy) + NODE_BIAS) >> (node)->level) == (node)->y && \
+                                        (((cz) + NODE_BIAS) >> (node)->level) == (node)->z)
+
+// the first block of a node along one axis
+#define nodeStart(node, v) ((((v) << (node)->level) - NODE_BIAS) * CHUNK_SIZE)
+
+static WorldNode *createNode(World *world, WorldNode *parent, int level, int x, int y, int z) {
+    WorldNode *node = poolAlloc(&world->nodes);
+
+    node->parent = parent;
+    node->level = level;
+    node->x = x;
+    node->y = y;
+    node->z = z;
+
+    return node;
+}
+
+// recounts a leaf from its chunk, or any other node from its children
+static void summarizeNode(WorldNode *node) {
+    unsigned long long count = 0, r = 0, g = 0, b = 0;
+    WorldNode *child;
+    Color color;
+    int i, uniform;
+
+    if (node->chunk) {
+        if (node->chunk->uniform) {
+            uniform = node->chunk->palette_size > 1;
+            count = uniform ? BLOCKS_PER_CHUNK : 0;
+            color = node->chunk->palette[node->chunk->palette_size - 1];
+            r = count * color.r; g = count * color.g; b = count * color.b;
+        } else {
+            uniform = 0;
+
+            for (i = 0; i < BLOCKS_PER_CHUNK; i++) {
+                if (blockActive(node->chunk, i)) {
+                    color = node->chunk->palette[blockPaletteIndex(node->chunk, i)];
+                    count++;
+                    r += color.r; g += color.g; b += color.b;
+                }
+            }
+        }
+    } else {
+        uniform = 1;
+
+        for (i = 0; i < 8; i++) {
+            child = node->children[i];
+
+            if (!child) {
+                uniform = 0;
+                continue;
+            }
+
+            if (!child->uniform || child->color.all != node->children[0]->color.all)
+                uniform = 0;
+
+            count += child->count;
+            r += child->count * child->color.r;
+            g += child->count * child->color.g;
+            b += child->count * child->color.b;
+        }
+    }
+
+    node->count = count;
+    node->uniform = uniform;
+    node->color.all = 0;
+
+    if (count) {
+        node->color.r = r / count;
+        node->color.g = g / count;
+        node->color.b = b / count;
+        node->color.a = 255;
+    }
+}
+
+static void updateNode(WorldNode *node) {
+    for (; node; node = node->parent)
+        summarizeNode(node);
+}
+
+// called whenever the blocks of a chunk change
+static void updateChunkNode(Chunk *chunk) {
+    if (chunk->node)
+        updateNode(chunk->node);
+}
+
+static void insertNode(World *world, Chunk *chunk) {
+    WorldNode *node = world->root, *root;
+    int i;
+
+    // grow upwards until the root covers the chunk
+    while (node && !nodeContains(node, chunk->x, chunk->y, chunk->z)) {
+        root = createNode(world, NULL, node->level + 1, node->x >> 1, node->y >> 1, node->z >> 1);
+        root->children[(node->x & 1) << 2 | (node->y & 1) << 1 | (node->z & 1)] = node;
+        node->parent = root;
+        node = root;
+    }
+
+    if (!node)
+        node = createNode(world, NULL, 0, chunk->x + NODE_BIAS, chunk->y + NODE_BIAS, chunk->z + NODE_BIAS);
+
+    world->root = node;
+
+    while (node->level > 0) {
+        i = childIndex(node->level, chunk->x, chunk->y, chunk->z);
+
+        if (!node->children[i])
+            node->children[i] = createNode(world, node, node->level - 1,
+                                           (chunk->x + NODE_BIAS) >> (node->level - 1),
+                                           (chunk->y + NODE_BIAS) >> (node->level - 1),
+                                           (chunk->z + NODE_BIAS) >> (node->level - 1));
+
+        node = node->children[i];
+    }
+
+    node->chunk = chunk;
+    chunk->node = node;
+
+    updateNode(node);
+}
+
+// frees the chunk's leaf, along with any nodes that are left without children
+static void removeNode(World *world, Chunk *chunk) {
+    WorldNode *node = chunk->node, *parent;
+    int i;
+
+    chunk->node = NULL;
+
+    while ((parent = node->parent)) {
+        for (i = 0; parent->children[i] != node; i++);
+        parent->children[i] = NULL;
+        poolFree(&world->nodes, node);
+
+        for (i = 0; i < 8 && !parent->children[i]; i++);
+
+        if (i < 8) {
+            updateNode(parent);
+            return;
+        }
+
+        node = parent;
+    }
+
+    poolFree(&world->nodes, node);
+    world->root = NULL;
+}
+
+// the level of the largest node around chunk (x, y, z) that has nothing
+// in it, or -1 if the chunk has blocks in it. The world must have a root.
+// Nodes above MAX_NODE_LEVEL - 1 don't line up with world coordinates, but
+// any smaller node inside of them is just as empty
+static int emptyLevel(World *world, int x, int y, int z) {
+    WorldNode *node = world->root, *child;
+
+    // everything next to the root is empty, in nodes as big as the root
+    if (!nodeContains(node, x, y, z))
+        return node->level;
+
+    if (!node->count)
+        return MAX_NODE_LEVEL - 1;
+
+    while (node->count) {
+        if (!node->level)
+            return -1;
+
+        child = node->children[childIndex(node->level, x, y, z)];
+
+        if (!child)
+            return node->level - 1;
+
+        node = child;
+    }
+
+    return node->level;
+}
+
+// whether anything in the node is active within [min, max) (in blocks)
+static int solidBlockInNode(WorldNode *node, const int *min, const int *max) {
+    int size = CHUNK_SIZE << node->level;
+    int lo[3] = {nodeStart(node, node->x), nodeStart(node, node->y), nodeStart(node, node->z)};
+    int end[3];
+    int y, z, i;
+    ChunkRow span;
+
+    if (!node->count)
+        return 0;
+
+    for (i = 0; i < 3; i++) {
+        if (lo[i] >= max[i] || lo[i] + size <= min[i])
+            return 0;
+    }
+
+    if (node->uniform)
+        return 1;
+
+    if (node->chunk) {
+        // clip the area to the chunk, and test each of its rows at once
+        for (i = 0; i < 3; i++) {
+            end[i] = max[i] - lo[i];
+            if (end[i] > CHUNK_SIZE)
+                end[i] = CHUNK_SIZE;
+
+            lo[i] = min[i] > lo[i] ? min[i] - lo[i] : 0;
+        }
+
+        span = (ChunkRow)(FULL_ROW >> (CHUNK_SIZE - (end[0] - lo[0]))) << lo[0];
+
+        for (y = lo[1]; y < end[1]; y++) {
+            for (z = lo[2]; z < end[2]; z++) {
+                if (chunkActiveRow(node->chunk, rowIndex(y, z)) & span)
+                    return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    for (i = 0; i < 8; i++) {
+        if (node->children[i] && solidBlockInNode(node->children[i], min, max))
+            return 1;
+    }
+
+    return 0;
+}
+
+static void coarsenNode(WorldNode *node, Chunk *chunk, int level, int x, int y, int z) {
+    int shift = node->level - level;
+    int i;
+
+    if (!node->count)
+        return;
+
+    // a node no bigger than a block of the chunk fills that block
+    if (shift <= 0) {
+        x = (node->x >> -shift) - x;
+        y = (node->y >> -shift) - y;
+        z = (node->z >> -shift) - z;
+
+        if (!((x | y | z) & ~(CHUNK_SIZE - 1)))
+            storeBlock(chunk, x, y, z, (Block){1, node->color, NULL, NULL});
+
+        return;
+    }
+
+    // skip nodes that are entirely outside of the chunk
+    if ((node->x << shift) >= x + CHUNK_SIZE || ((node->x + 1) << shift) <= x ||
+        (node->y << shift) >= y + CHUNK_SIZE || ((node->y + 1) << shift) <= y ||
+        (node->z << shift) >= z + CHUNK_SIZE || ((node->z + 1) << shift) <= z)
+        return;
+
+    for (i = 0; i < 8; i++) {
+        if (node->children[i])
+            coarsenNode(node->children[i], chunk, level, x, y, z);
+    }
+}
+
+// fills an empty chunk with a coarse copy of part of the world, for drawing it
+// from far away. Each block of the chunk stands for a node at level, starting
+// at node (x, y, z), and has the average color of whatever is in that node.
+// level can be at most MAX_NODE_LEVEL - 1. Mesh the chunk with
+// renderChunkWithMeshing at a scale of CHUNK_SIZE << level
+void coarseChunk(World *world, Chunk *chunk, int level, int x, int y, int z) {
+    int bias = NODE_BIAS >> level;
+
+    if (world->root)
+        coarsenNode(world->root, chunk, level, x + bias, y + bias, z + bias);
+}
+
+#undef childIndex
+#undef nodeContains
+#undef nodeStart
+
+static void retire(World *world, void *ptr) {
+    world->retired = realloc(world->retired, (world->num_retired + 1) * sizeof(void*));
+    world->retired[world->num_retired++] = ptr;
+}
+
+static inline unsigned int hashKey(unsigned long long key) {
+    return (key * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+static ChunkTable *createTable(unsigned int num_slots) {
+    ChunkTable *table = calloc(1, sizeof(ChunkTable) + num_slots * sizeof(ChunkSlot));
+
+    table->num_slots = num_slots;
+
+    return table;
+}
+
+static void insertSlot(ChunkTable *table, Chunk *chunk) {
+    unsigned long long key = chunkKey(chunk->x, chunk->y, chunk->z);
+    unsigned int mask = table->num_slots - 1;
+    unsigned int i = hashKey(key) & mask;
+
+    while (table->slots[i].chunk)
+        i = (i + 1) & mask;
+
+    // the key has to be there before a reader can find the chunk
+    table->slots[i].key = key;
+    __atomic_store_n(&table->slots[i].chunk, chunk, __ATOMIC_RELEASE);
+}
+
+// the chunks on either side of a chunk along each axis hide each other's faces
+static void linkChunk(World *world, Chunk *chunk) {
+    int d, step[3];
+    Chunk *nb;
+
+    for (d = 0; d < 6; d++) {
+        step[0] = step[1] = step[2] = 0;
+        step[d / 2] = (d & 1) ? 1 : -1;
+
+        nb = worldChunk(world, chunk->x + step[0], chunk->y + step[1], chunk->z + step[2]);
+        chunk->neighbors[d] = nb;
+
+        if (nb) {
+            nb->neighbors[d ^ 1] = chunk;
+            fillBorder(chunk, d, nb);
+            fillBorder(nb, d ^ 1, chunk);
+        }
+    }
+}
+
+static void unlinkChunk(Chunk *chunk) {
+    int d;
+
+    for (d = 0; d < 6; d++) {
+        if (chunk->neighbors[d]) {
+            chunk->neighbors[d]->neighbors[d ^ 1] = NULL;
+            fillBorder(chunk->neighbors[d], d ^ 1, NULL);
+            chunk->neighbors[d] = NULL;
+        }
+
+        fillBorder(chunk, d, NULL);
+    }
+}
+
+// the logic thread reads the world while the main thread adds chunks to it,
+// so the new arrays are filled in before they replace the old ones, and the
+// count goes up only once the chunk is in the array
+static void insertChunk(World *world, Chunk *chunk) {
+    ChunkTable *table;
+    Chunk **chunks;
+    unsigned int i;
+
+    if (2 * (world->num_chunks + 1) > world->table->num_slots) {
+        table = createTable(2 * world->table->num_slots);
+
+        for (i = 0; i < world->num_chunks; i++)
+            insertSlot(table, world->chunks[i]);
+
+        retire(world, world->table);
+        __atomic_store_n(&world->table, table, __ATOMIC_RELEASE);
+    }
+
+    insertSlot(world->table, chunk);
+
+    if (world->num_chunks == world->max_chunks) {
+        world->max_chunks *= 2;
+        chunks = malloc(world->max_chunks * sizeof(Chunk*));
+        memcpy(chunks, world->chunks, world->num_chunks * sizeof(Chunk*));
+
+        retire(world, world->chunks);
+        __atomic_store_n(&world->chunks, chunks, __ATOMIC_RELEASE);
+    }
+
+    world->chunks[world->num_chunks] = chunk;
+    __atomic_store_n(&world->num_chunks, world->num_chunks + 1, __ATOMIC_RELEASE);
+
+    insertNode(world, chunk);
+    linkChunk(world, chunk);
+}
+
+Chunk *addChunk(World *world, int x, int y, int z) {
+    Chunk *chunk = worldChunk(world, x, y, z);
+    ChunkLocation *location;
+
+    if (!chunk) {
+        // a streamed world may have the chunk, just not loaded yet
+        location = world->stream ? findLocation(world->stream, x, y, z) : NULL;
+
+        if (location && locationHasBlocks(location)) {
+            chunk = loadChunk(world, location);
+        } else {
+            chunk = createChunk(x, y, z);
+            insertChunk(world, chunk);
+        }
+    }
+
+    return chunk;
+}
+
+// takes the chunk out of the world without freeing it. The logic thread
+// may still be looking at it, so it shouldn't be freed while that's running
+Chunk *removeChunk(World *world, int x, int y, int z) {
+    ChunkTable *table = world->table;
+    unsigned long long key = chunkKey(x, y, z);
+    unsigned int mask = table->num_slots - 1;
+    unsigned int i = hashKey(key) & mask, j, home;
+    Chunk *chunk;
+
+    while (table->slots[i].chunk && table->slots[i].key != key)
+        i = (i + 1) & mask;
+
+    chunk = table->slots[i].chunk;
+
+    if (!chunk)
+        return NULL;
+
+    // shift back the entries after it that would otherwise become unreachable
+    for (j = (i + 1) & mask; table->slots[j].chunk; j = (j + 1) & mask) {
+        home = hashKey(table->slots[j].key) & mask;
+
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            table->slots[i] = table->slots[j];
+            i = j;
+        }
+    }
+
+    table->slots[i].chunk = NULL;
+
+    for (i = 0; world->chunks[i] != chunk; i++);
+    world->chunks[i] = world->chunks[--world->num_chunks];
+
+    removeNode(world, chunk);
+    unlinkChunk(chunk);
+
+    return chunk;
+}
+
+// streaming
+
+static ChunkLocation *findSlot(ChunkLocation *locations, unsigned int num_slots, int x, int y, int z) {
+    unsigned int mask = num_slots - 1;
+    unsigned int i = hashKey(chunkKey(x, y, z)) & mask;
+
+    while (locations[i].used && !(locations[i].x == x && locations[i].y == y && locations[i].z == z))
+        i = (i + 1) & mask;
+
+    return &locations[i];
+}
+
+static ChunkLocation *findLocation(WorldStream *stream, int x, int y, int z) {
+    ChunkLocation *location = findSlot(stream->locations, stream->num_slots, x, y, z);
+
+    return location->used ? location : NULL;
+}
+
+static int locationHasBlocks(ChunkLocation *location) {
+    int p;
+
+    for (p = 0; p < PARTS_PER_CHUNK; p++) {
+        if (location->parts[p].length)
+            return 1;
+    }
+
+    return 0;
+}
+
+static ChunkLocation *addLocation(WorldStream *stream, int x, int y, int z) {
+    ChunkLocation *location, *locations;
+    unsigned int i, num_slots;
+
+    if (2 * (stream->num_locations + 1) > stream->num_slots) {
+        num_slots = 2 * stream->num_slots;
+        locations = calloc(num_slots, sizeof(ChunkLocation));
+
+        for (i = 0; i < stream->num_slots; i++) {
+            location = &stream->locations[i];
+
+            if (location->used)
+                *findSlot(locations, num_slots, location->x, location->y, location->z) = *location;
+        }
+
+        free(stream->locations);
+        stream->locations = locations;
+        stream->num_slots = num_slots;
+    }
+
+    location = findSlot(stream->locations, stream->num_slots, x, y, z);
+
+    if (!location->used) {
+        *location = (ChunkLocation){x, y, z, 1};
+        stream->num_locations++;
+    }
 
-        data.logic = !!(block->logic);
-        data.data = !data.logic && block->data;
-        if (data.logic) {
-            data.logic_type = block->logic->type;
-            data.logic_roll = block->logic->roll;
-            data.logic_pitch = block->logic->pitch;
-            data.logic_yaw = block->logic->yaw;
-        }
-        data.color = block->color;
+    return location;
+}
 
-        char equal = data.logic == buf.data.logic && data.data == !!buf.data.data &&
-                     (!data.logic || (data.logic_type == buf.data.logic_type && data.logic_roll == buf.data.logic_roll &&
-                       data.logic_pitch == buf.data.logic_pitch && data.logic_yaw == buf.data.logic_yaw)) &&
-                     data.color.all == buf.data.color.all && !data.data;
+static Chunk *loadChunk(World *world, ChunkLocation *location) {
+    Chunk *chunk = createChunk(location->x, location->y, location->z);
+    FILE *in;
+    int p;
 
-        if (equal) {
-            buf.count++;
-        } else {
-            if (buf.count)
-                fwrite(&buf, sizeof(RLE_BlockData), 1, out);
+    for (p = 0; p < PARTS_PER_CHUNK; p++) {
+        if (!location->parts[p].length)
+            continue;
 
-            buf.count = 1;
-            buf.data = data;
+        in = location->parts[p].swapped ? world->stream->swap : world->stream->file;
+        fseek(in, location->parts[p].offset, SEEK_SET);
 
-            if (data.data) {
-                fwrite(&buf, sizeof(buf), 1, out);
-                buf.count = 0;
-                buf.data = (BlockData){0};
-                writeChunk(block->data->chunk, out);
-            }
+        if (!readPart(chunk, in, p)) {
+            freeChunk(chunk);
+            chunk = createChunk(location->x, location->y, location->z);
+            break;
         }
-
-        data = (BlockData){0};
     }
 
-    if (buf.count) fwrite(&buf, sizeof(buf), 1, out);
+    // finished before it goes in the world, where the logic thread can see it.
+    // It's meshed along with the other chunks that need it, off the main thread
+    prepareChunk(chunk);
+    chunk->needsUpdate = 1;
+    insertChunk(world, chunk);
+
+    return chunk;
 }
 
-void writeWorld(World *world, char *file_path) {
-    FILE *out = fopen(file_path, "wb");
+// copies the parts still in use into a new swap file, leaving out the ones that
+// were written again since. If there's no new file to be had the old one is kept
+static void compactSwap(WorldStream *stream) {
+    FILE *swap = tmpfile();
+    ChunkLocation *location;
+    long offset;
+    int i, p;
 
-    if (!out) {
-        fprintf(stderr, "Error writing %s: file not found\n", file_path);
+    if (!swap)
         return;
-    }
 
-    fwrite(&world->size, sizeof(world->size), 1, out);
+    for (i = 0; i < stream->num_slots; i++) {
+        location = &stream->locations[i];
 
-    for (int i = 0; i < world->num_chunks; i++) {
-        writeChunk(world->chunks[i], out);
+        for (p = 0; location->used && p < PARTS_PER_CHUNK; p++) {
+            if (location->parts[p].swapped && location->parts[p].length) {
+                offset = ftell(swap);
+                copyBytes(swap, stream->swap, location->parts[p].offset, location->parts[p].length);
+                location->parts[p].offset = offset;
+            }
+        }
     }
 
-    fclose(out);
+    fclose(stream->swap);
+    stream->swap = swap;
+    stream->swap_size = stream->swap_used = ftell(swap);
 }
 
-char readChunk(Chunk *chunk, FILE *in) {
-    RLE_BlockData buf;
-    BlockData data;
-    int count = 0, size, i = 0;
-    Block *block;
+// chunks that were changed are written to the swap file, so that
+// the world file itself is only written when the world is saved
+static void unloadChunk(World *world, Chunk *chunk) {
+    WorldStream *stream = world->stream;
+    ChunkLocation *location;
+    int p;
 
-    while (count < CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE) {
-        size = fread(&buf, sizeof(buf), 1, in);
+    if (chunk->modified) {
+        location = addLocation(stream, chunk->x, chunk->y, chunk->z);
+        fseek(stream->swap, 0, SEEK_END);
 
-        if (!size) { // file too short
-            fprintf(stderr, "Error reading world file");
-            if (feof(in)) fputs("; file too short", stderr);
-            else if (ferror(in)) fputs("; an error occured", stderr);
-            fputs("\n", stderr);
-            return 0;
+        for (p = 0; p < PARTS_PER_CHUNK; p++) {
+            if (location->parts[p].swapped)
+                stream->swap_used -= location->parts[p].length;
+
+            if (partIsEmpty(chunk, p)) {
+                location->parts[p].length = 0;
+            } else {
+                location->parts[p].offset = ftell(stream->swap);
+                writePart(chunk, stream->swap, p);
+                location->parts[p].length = ftell(stream->swap) - location->parts[p].offset;
+                location->parts[p].swapped = 1;
+                stream->swap_used += location->parts[p].length;
+            }
         }
 
-        // printf("read %d blocks\n", buf.count);
+        stream->swap_size = ftell(stream->swap);
 
-        count += buf.count;
-        data = buf.data;
+        if (stream->swap_size < 0) {
+            fprintf(stderr, "Error writing swap file: file too big\n");
+            exit(1);
+        }
 
-        while (buf.count > 0 && i < CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE) {
-            block = &chunk->blocks_lin[i];
+        if (stream->swap_size > SWAP_COMPACT_SIZE && stream->swap_size > 2 * stream->swap_used)
+            compactSwap(stream);
+    }
 
-            if (data.logic) {
-                block->logic = calloc(1, sizeof(Logic));
+    removeChunk(world, chunk->x, chunk->y, chunk->z);
 
-                block->logic->type = data.logic_type;
-                block->logic->roll = data.logic_roll;
-                block->logic->pitch = data.logic_pitch;
-                block->logic->yaw = data.logic_yaw;
+    stream->unloaded = realloc(stream->unloaded, (stream->num_unloaded + 1) * sizeof(Chunk*));
+    stream->unloaded[stream->num_unloaded++] = chunk;
+}
 
-                updateLogicModel(block);
-            }
+// reads past a part of a chunk without loading it. Returns whether
+// the part is empty, or -1 if the file is too short
+static int skipChunk(FILE *in) {
+    RLE_BlockData buf;
+    int count = 0, empty = 1, i;
 
-            if (data.data) {
-                block->data = createModel();
-                block->data->chunk = createChunk(0, 0, 0);
-                block->active = 1;
-                if (!readChunk(block->data->chunk, in))
-                    return 0;
-                renderModel(block->data);
-            }
+    while (count < BLOCKS_PER_PART) {
+        if (!fread(&buf, sizeof(buf), 1, in))
+            return -1;
 
-            block->color = data.color;
-            if (data.color.all) {
-                block->active = 1;
-            }
+        count += buf.count;
 
-            i++;
-            buf.count--;
+        if (buf.data.color.all || buf.data.logic || buf.data.data)
+            empty = 0;
+
+        // models are stored right after the block that holds them
+        for (i = 0; buf.data.data && i < buf.count; i++) {
+            if (skipChunk(in) < 0)
+                return -1;
         }
     }
 
-    renderChunk(chunk);
+    return empty;
+}
 
-    return 1;
+static int compareOffsets(const void *a, const void *b) {
+    const int *u = a, *v = b;
+
+    return (u[0]*u[0] + u[1]*u[1] + u[2]*u[2]) - (v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
 }
 
-World *readWorld(char *file_path) {
+// opens a world without loading any chunks. streamWorld loads
+// the ones within radius chunks of the player as they move around
+World *openWorld(char *file_path, int radius) {
     FILE *in = fopen(file_path, "rb");
 
     if (!in) {
@@ -647,69 +2659,182 @@ World *readWorld(char *file_path) {
         return NULL;
     }
 
-    unsigned int size;
+    unsigned int size, num_chunks, i;
+    int x, y, z, empty, sparse;
+    long offset;
+    ChunkEntry entry;
+    ChunkLocation *location;
+    WorldStream *stream;
+    World *world;
 
     fread(&size, sizeof(size), 1, in);
+    sparse = (size == SPARSE_WORLD);
 
-    World *world = createWorld(size);
+    if (sparse) {
+        fread(&size, sizeof(size), 1, in);
+        fread(&num_chunks, sizeof(num_chunks), 1, in);
+    } else {
+        num_chunks = size * size * size;
+    }
 
-    for (int i = 0; i < world->num_chunks; i++) {
-        if (!readChunk(world->chunks[i], in)) {
-            freeWorld(world);
-            fclose(in);
-            return NULL;
+    world = createWorld((size + PART_MASK) >> LOG_PARTS);
+    stream = world->stream = calloc(1, sizeof(WorldStream));
+
+    stream->file = in;
+    stream->swap = tmpfile();
+
+    for (stream->num_slots = 64; stream->num_slots < 2 * num_chunks; stream->num_slots *= 2);
+    stream->locations = calloc(stream->num_slots, sizeof(ChunkLocation));
+
+    if (sparse) {
+        // only the directory is read
+        for (i = 0; i < num_chunks && fread(&entry, sizeof(entry), 1, in); i++) {
+            location = addLocation(stream, entry.x >> LOG_PARTS, entry.y >> LOG_PARTS, entry.z >> LOG_PARTS);
+            location->parts[partIndex(entry.x, entry.y, entry.z)].offset = entry.offset;
+            location->parts[partIndex(entry.x, entry.y, entry.z)].length = entry.length;
+        }
+    } else {
+        // the original format has no directory, so the chunks have to be skipped over
+        for (x = 0; x < size; x++) {
+            for (y = 0; y < size; y++) {
+                for (z = 0; z < size; z++) {
+                    offset = ftell(in);
+                    empty = skipChunk(in);
+
+                    if (empty < 0) {
+                        fprintf(stderr, "Error reading world file; file too short\n");
+                        x = y = z = size;
+                    } else if (!empty) {
+                        location = addLocation(stream, x >> LOG_PARTS, y >> LOG_PARTS, z >> LOG_PARTS);
+                        location->parts[partIndex(x, y, z)].offset = offset;
+                        location->parts[partIndex(x, y, z)].length = ftell(in) - offset;
+                    }
+                }
+            }
         }
     }
 
-    fclose(in);
+    stream->radius = radius;
+
+    stream->offsets = malloc((2*radius + 1) * (2*radius + 1) * (2*radius + 1) * sizeof(stream->offsets[0]));
+
+    for (x = -radius; x <= radius; x++) {
+        for (y = -radius; y <= radius; y++) {
+            for (z = -radius; z <= radius; z++) {
+                if (x*x + y*y + z*z <= radius*radius) {
+                    stream->offsets[stream->num_offsets][0] = x;
+                    stream->offsets[stream->num_offsets][1] = y;
+                    stream->offsets[stream->num_offsets][2] = z;
+                    stream->num_offsets++;
+                }
+            }
+        }
+    }
+
+    qsort(stream->offsets, stream->num_offsets, sizeof(stream->offsets[0]), compareOffsets);
 
     return world;
 }
 
-World * createWorld(unsigned int size) {
-    World *world = malloc(sizeof(World));
+static void streamCenter(vec3 position, int center[3]) {
+    int i;
 
-    world->size = size;
-    world->num_chunks = size * size * size;
+    for (i = 0; i < 3; i++)
+        center[i] = floor(position[i] / CHUNK_WIDTH);
+}
 
-    world->chunks = calloc(world->num_chunks, sizeof(Chunk*));
+// whether streamWorld will unload chunks this time. Unloading moves chunks around
+// in the world's table and array, so the logic thread mustn't be running then
+int streamMoved(World *world, vec3 position) {
+    int center[3];
 
-    int x, y, z;
+    if (!world->stream)
+        return 0;
 
-    for (x = 0; x < world->size; x++) {
-        for (y = 0; y < world->size; y++) {
-            for (z = 0; z < world->size; z++) {
-                getChunk(world, x, y, z) = createChunk(x, y, z);
-            }
+    streamCenter(position, center);
+
+    return memcmp(center, world->stream->center, sizeof(center)) != 0;
+}
+
+// keeps the chunks around position loaded, a few at a time. Loading is safe with
+// the logic thread running, but it has to be stopped whenever streamMoved says
+// so. Returns the number of chunks that were unloaded, which have to be freed
+// with freeUnloadedChunks before the logic thread runs again
+int streamWorld(World *world, vec3 position) {
+    WorldStream *stream = world->stream;
+    ChunkLocation *location;
+    Chunk *chunk;
+    int center[3], d[3], *offset, i, loads = 0;
+
+    if (!stream)
+        return 0;
+
+    streamCenter(position, center);
+
+    if (memcmp(center, stream->center, sizeof(center)) != 0) {
+        memcpy(stream->center, center, sizeof(center));
+        stream->next_offset = 0;
+
+        // going backwards, since removing a chunk moves the last one in its place.
+        // chunks are kept until they're a chunk past the radius, so that
+        // moving back and forth over a chunk border doesn't reload them
+        for (i = world->num_chunks; i-- > 0;) {
+            chunk = world->chunks[i];
+
+            d[0] = chunk->x - center[0];
+            d[1] = chunk->y - center[1];
+            d[2] = chunk->z - center[2];
+
+            if (d[0]*d[0] + d[1]*d[1] + d[2]*d[2] > (stream->radius + 1) * (stream->radius + 1))
+                unloadChunk(world, chunk);
         }
     }
 
-    unsigned int world_block_width = world->size * CHUNK_SIZE;
+    while (stream->next_offset < stream->num_offsets && loads < STREAM_LOADS_PER_TICK) {
+        offset = stream->offsets[stream->next_offset++];
 
-    // link neighbors in the world
-    for (x = 0; x < world_block_width; x++) {
-        for (y = 0; y < world_block_width; y++) {
-            for (z = 0; z < world_block_width; z++) {
-                Block *block = worldBlock(world, x, y, z);
+        d[0] = center[0] + offset[0];
+        d[1] = center[1] + offset[1];
+        d[2] = center[2] + offset[2];
 
-                block->nb_pos_x = worldBlock(world, x+1, y, z);
-                block->nb_neg_x = worldBlock(world, x-1, y, z);
-                block->nb_pos_y = worldBlock(world, x, y+1, z);
-                block->nb_neg_y = worldBlock(world, x, y-1, z);
-                block->nb_pos_z = worldBlock(world, x, y, z+1);
-                block->nb_neg_z = worldBlock(world, x, y, z-1);
-            }
+        location = findLocation(stream, d[0], d[1], d[2]);
+
+        if (location && locationHasBlocks(location) && !worldChunk(world, d[0], d[1], d[2])) {
+            loadChunk(world, location);
+            loads++;
         }
     }
 
+    return stream->num_unloaded;
+}
+
+void freeUnloadedChunks(World *world) {
+    WorldStream *stream = world->stream;
+
+    while (stream && stream->num_unloaded)
+        freeChunk(stream->unloaded[--stream->num_unloaded]);
+}
+
+World * createWorld(unsigned int size) {
+    World *world = calloc(1, sizeof(World));
+
+    world->size = size;
+
+    world->max_chunks = 64;
+    world->chunks = malloc(world->max_chunks * sizeof(Chunk*));
+    world->table = createTable(2 * world->max_chunks);
+    world->nodes = (Pool)POOL(WorldNode, 256);
+
     return world;
 }
 
 void fillWorld(World *world) {
+    Edit *edit = beginEdit(world);
     int cx, cy, cz, bx, by, bz;
 
+    // only the bottom layer has anything in it
     for (cx = 0; cx < world->size; cx++) {
-        for (cy = 0; cy < world->size; cy++) {
+        for (cy = 0; cy < 1; cy++) {
             for (cz = 0; cz < world->size; cz++) {
                 for (bx = 0; bx < CHUNK_SIZE; bx++) {
                     for (by = 0; by < CHUNK_SIZE; by++) {
@@ -722,7 +2847,7 @@ void fillWorld(World *world) {
                             }
 
                             if (by == 0 && cy == 0) {
-                                setBlock(getChunk(world, cx, cy, cz), bx, by, bz,
+                                editBlock(edit, cx * CHUNK_SIZE + bx, cy * CHUNK_SIZE + by, cz * CHUNK_SIZE + bz,
                                     (Block){1, {{255 & (r|m), 255 & m, 255 & m, 255}}});
                             }
                             // } else if (((bx == 0 && cx == 0) || (bz == 0 && cz == 0)) && by == 1 && cy == 0) {
@@ -732,11 +2857,11 @@ void fillWorld(World *world) {
                         }
                     }
                 }
-
-                renderChunk(getChunk(world, cx, cy, cz));
             }
         }
     }
+
+    commitEdit(edit);
 }
 
 void drawWorld(World *world, mat4 viewMatrix, mat4 projectionMatrix) {
@@ -751,6 +2876,31 @@ void drawWorld(World *world, mat4 viewMatrix, mat4 projectionMatrix) {
     }
 }
 
+// the model blocks of the chunks, each group drawn as instances of its model
+void drawWorldModels(World *world, mat4 viewMatrix, mat4 projectionMatrix) {
+    int i, j;
+    Chunk *chunk;
+    InstanceGroup *group;
+    mat4 modelMatrix;
+
+    for (i = 0; i < world->num_chunks; i++) {
+        chunk = world->chunks[i];
+
+        if (chunk->num_instance_groups == 0 || !isVisible(chunk, viewMatrix, projectionMatrix))
+            continue;
+
+        // the instances are placed in blocks, from the corner of the chunk
+        identity_m4(modelMatrix);
+        scale_m4(modelMatrix, BLOCK_WIDTH);
+        translate_m4(modelMatrix, chunk->x * CHUNK_WIDTH, chunk->y * CHUNK_WIDTH, chunk->z * CHUNK_WIDTH);
+
+        for (j = 0; j < chunk->num_instance_groups; j++) {
+            group = &chunk->instance_groups[j];
+            drawInstances(group->model->chunk->mesh, modelMatrix, chunk->instance_buffer, group->first, group->count);
+        }
+    }
+}
+
 void freeWorld(World *world) {
     int i;
 
@@ -758,26 +2908,287 @@ void freeWorld(World *world) {
         freeChunk(world->chunks[i]);
     }
 
+    for (i = 0; i < world->num_retired; i++) {
+        free(world->retired[i]);
+    }
+
+    free(world->retired);
+    free(world->table);
+    freePool(&world->nodes);
     free(world->chunks);
 
+    if (world->stream) {
+        freeUnloadedChunks(world);
+        fclose(world->stream->file);
+        fclose(world->stream->swap);
+        free(world->stream->locations);
+        free(world->stream->offsets);
+        free(world->stream->unloaded);
+        free(world->stream);
+    }
+
     free(world);
 }
 
+// stores the block, freeing the logic or model that was there before
+static void replaceBlock(Chunk *chunk, int x, int y, int z, Block block) {
+    Block current = getBlock(chunk, x, y, z);
+
+    storeBlock(chunk, x, y, z, block);
+
+    // logic blocks point at the shared logic models, and don't hold on to them.
+    // They're freed once they're no longer in the chunk, and the logic thread
+    // can no longer find them
+    if (current.logic && current.logic != block.logic)
+        freeLogic(current.logic);
+    else if (!current.logic && current.data && current.data != block.data)
+        releaseModel(current.data);
+    // the block came with a reference of its own, and the slot already had one
+    else if (!current.logic && !block.logic && current.data && current.data == block.data)
+        releaseModel(block.data);
+}
+
 void setBlock(Chunk *chunk, int x, int y, int z, Block block) {
-    Block *current = getBlock(chunk, x, y, z);
+    int d, dirty = 0;
+
+    // only chunks edited a block at a time keep their mesh in pieces. Bulk
+    // edits and loads mesh the whole chunk anyway
+    cacheChunkMesh(chunk);
+    replaceBlock(chunk, x, y, z, block);
+    updateChunkNode(chunk);
+
+    for (d = 0; d < 6; d++)
+        dirty |= chunk->mesh_dirty[d] != 0;
+
+    // placing, swapping or turning a model leaves the cubes as they were
+    if (dirty)
+        renderChunk(chunk);
+    else if (chunk->instancesNeedUpdate)
+        updateChunkInstances(chunk);
+}
 
-    if (current->logic)
-        freeLogic(current->logic);
+// edits
 
-    block.nb_pos_x = current->nb_pos_x;
-    block.nb_neg_x = current->nb_neg_x;
-    block.nb_pos_y = current->nb_pos_y;
-    block.nb_neg_y = current->nb_neg_y;
-    block.nb_pos_z = current->nb_pos_z;
-    block.nb_neg_z = current->nb_neg_z;
+Edit *beginEdit(World *world) {
+    Edit *edit = calloc(1, sizeof(Edit));
 
-    *getBlock(chunk, x, y, z) = block;
-    renderChunk(chunk);
+    edit->world = world;
+
+    return edit;
+}
+
+// remembers the chunk so that it's remeshed when the edit is committed
+static void markEdited(Edit *edit, Chunk *chunk) {
+    if (chunk->edited)
+        return;
+
+    chunk->edited = 1;
+
+    if (edit->num_chunks == edit->max_chunks) {
+        edit->max_chunks = edit->max_chunks ? 2 * edit->max_chunks : 16;
+        edit->chunks = realloc(edit->chunks, edit->max_chunks * sizeof(Chunk*));
+    }
+
+    edit->chunks[edit->num_chunks++] = chunk;
+}
+
+// the chunk with block (x, y, z) in it. Missing chunks are only created if create is set
+static Chunk *editChunk(Edit *edit, int x, int y, int z, int create) {
+    Chunk *chunk = edit->last;
+
+    x >>= LOG_CHUNK_SIZE;
+    y >>= LOG_CHUNK_SIZE;
+    z >>= LOG_CHUNK_SIZE;
+
+    if (chunk && chunk->x == x && chunk->y == y && chunk->z == z)
+        return chunk;
+
+    chunk = create ? addChunk(edit->world, x, y, z) : worldChunk(edit->world, x, y, z);
+
+    if (!chunk)
+        return NULL;
+
+    markEdited(edit, chunk);
+
+    return edit->last = chunk;
+}
+
+// like setBlock, but the chunk is only remeshed once the edit is committed
+void editBlock(Edit *edit, int x, int y, int z, Block block) {
+    // air doesn't need a chunk to be made for it
+    Chunk *chunk = editChunk(edit, x, y, z, block.active);
+
+    if (chunk)
+        replaceBlock(chunk, x & BLOCK_MASK, y & BLOCK_MASK, z & BLOCK_MASK, block);
+}
+
+// fills [min, max) with copies of block. The caller keeps the block itself
+void fillRegion(Edit *edit, int minx, int miny, int minz, int maxx, int maxy, int maxz, Block block) {
+    int x, y, z;
+
+    for (x = minx; x < maxx; x++) {
+        for (y = miny; y < maxy; y++) {
+            for (z = minz; z < maxz; z++)
+                editBlock(edit, x, y, z, duplicateBlock(block));
+        }
+    }
+}
+
+// copies the blocks in [min, max) of src so that min ends up at (x, y, z).
+// src can be the world being edited, even if the areas overlap
+void copyRegion(Edit *edit, World *src, int minx, int miny, int minz, int maxx, int maxy, int maxz, int x, int y, int z) {
+    int from[3] = {minx, miny, minz}, to[3] = {x, y, z};
+    int size[3] = {maxx - minx, maxy - miny, maxz - minz};
+    int first[3], step[3], d[3], i, j, k;
+
+    // blocks moving forwards within a world are copied starting from the
+    // far end, so that none are overwritten before they've been copied
+    for (i = 0; i < 3; i++) {
+        step[i] = (src == edit->world && to[i] > from[i]) ? -1 : 1;
+        first[i] = step[i] < 0 ? size[i] - 1 : 0;
+    }
+
+    for (i = 0; i < size[0]; i++) {
+        d[0] = first[0] + i * step[0];
+
+        for (j = 0; j < size[1]; j++) {
+            d[1] = first[1] + j * step[1];
+
+            for (k = 0; k < size[2]; k++) {
+                d[2] = first[2] + k * step[2];
+
+                editBlock(edit, to[0] + d[0], to[1] + d[1], to[2] + d[2],
+                          duplicateBlock(worldBlock(src, from[0] + d[0], from[1] + d[1], from[2] + d[2])));
+            }
+        }
+    }
+}
+
+// like copyRegion, but copies whole chunks at a time, in chunk coordinates
+void copyChunks(Edit *edit, World *src, int minx, int miny, int minz, int maxx, int maxy, int maxz, int x, int y, int z) {
+    int from[3] = {minx, miny, minz}, to[3] = {x, y, z};
+    int size[3] = {maxx - minx, maxy - miny, maxz - minz};
+    int first[3], step[3], d[3], i, j, k;
+    Chunk *chunk, *dest;
+
+    for (i = 0; i < 3; i++) {
+        step[i] = (src == edit->world && to[i] > from[i]) ? -1 : 1;
+        first[i] = step[i] < 0 ? size[i] - 1 : 0;
+    }
+
+    for (i = 0; i < size[0]; i++) {
+        d[0] = first[0] + i * step[0];
+
+        for (j = 0; j < size[1]; j++) {
+            d[1] = first[1] + j * step[1];
+
+            for (k = 0; k < size[2]; k++) {
+                d[2] = first[2] + k * step[2];
+
+                chunk = worldChunk(src, from[0] + d[0], from[1] + d[1], from[2] + d[2]);
+
+                // empty chunks only need copying over chunks that are already there
+                if (chunk && !chunkIsEmpty(chunk))
+                    dest = addChunk(edit->world, to[0] + d[0], to[1] + d[1], to[2] + d[2]);
+                else
+                    dest = worldChunk(edit->world, to[0] + d[0], to[1] + d[1], to[2] + d[2]);
+
+                if (!dest || dest == chunk)
+                    continue;
+
+                if (chunk) {
+                    copyChunkBlocks(dest, chunk);
+                } else {
+                    beginChunkWrite(dest);
+                    freeChunkExtra(dest);
+                    makeUniform(dest, (Color){.all = 0});
+                    dest->modified = 1;
+                    endChunkWrite(dest);
+                }
+
+                markEdited(edit, dest);
+            }
+        }
+    }
+}
+
+// remeshes each chunk the edit touched on the mesh threads, and frees the edit.
+// The instances are only ever built on the main thread, so they're done here
+void commitEdit(Edit *edit) {
+    Chunk *chunk;
+    unsigned int i;
+
+    for (i = 0; i < edit->num_chunks; i++) {
+        chunk = edit->chunks[i];
+        chunk->edited = 0;
+
+        updateChunkNode(chunk);
+        queueChunkMesh(chunk);
+
+        if (chunk->instancesNeedUpdate)
+            updateChunkInstances(chunk);
+    }
+
+    free(edit->chunks);
+    free(edit);
+}
+
+// like setBlock, but doesn't re-render the chunk or free what was there before.
+// a block is active if it has a color or a model, so inactive blocks are stored as air.
+void storeBlock(Chunk *chunk, int x, int y, int z, Block block) {
+    int i = blockIndex(x, y, z);
+
+    BlockExtra current = {NULL, NULL};
+    unsigned int index;
+    int active, was_cube;
+
+    if (!block.active)
+        block = EMPTY_BLOCK;
+
+    // writing the color a uniform chunk already has changes nothing
+    if (chunk->uniform && !block.data && !block.logic &&
+        block.color.all == chunk->palette[chunk->palette_size - 1].all)
+        return;
+
+    beginChunkWrite(chunk);
+
+    index = paletteIndex(chunk, block.color);
+
+    if (chunk->uniform)
+        promoteChunk(chunk);
+
+    active = index || block.data;
+
+    if (chunk->extra)
+        current = chunk->extra[i];
+
+    was_cube = blockActive(chunk, i) && !current.data;
+
+    // the counts are kept up to date here, instead of recounting whole chunks
+    if (active)
+        growChunkBounds(chunk, x, y, z);
+
+    chunk->num_active += active - blockActive(chunk, i);
+    chunk->num_models += (block.data != NULL) - (current.data != NULL);
+    chunk->num_logic += (block.logic != NULL) - (current.logic != NULL);
+
+    setPaletteIndex(chunk, i, index);
+    setRowBit(chunk->active_rows, i, active);
+    storeBlockData(chunk, i, &block);
+
+    // the mesh only has the cubes, so swapping one model for another, or turning
+    // it, only changes the instances
+    if (was_cube || (index && !block.data)) {
+        dirtyBlockSlices(chunk, x, y, z);
+        updateBorderBlock(chunk, x, y, z);
+    }
+
+    if (block.data != current.data || block.logic != current.logic)
+        chunk->instancesNeedUpdate = 1;
+
+    chunk->modified = 1;
+
+    endChunkWrite(chunk);
 }
 
 void buildBlockFrame(Mesh *mesh) {
@@ -871,15 +3282,21 @@ int isVisible(Chunk *chunk, mat4 view, mat4 perspective) {
     multiply_m4(MVP, view);
     multiply_m4(MVP, perspective);
 
+    // only the box around the chunk's blocks needs to be on screen. The model
+    // matrix takes packed steps rather than world units
+    float x0 = chunk->min[0] * (BLOCK_WIDTH / PACKED_STEP), x1 = chunk->max[0] * (BLOCK_WIDTH / PACKED_STEP);
+    float y0 = chunk->min[1] * (BLOCK_WIDTH / PACKED_STEP), y1 = chunk->max[1] * (BLOCK_WIDTH / PACKED_STEP);
+    float z0 = chunk->min[2] * (BLOCK_WIDTH / PACKED_STEP), z1 = chunk->max[2] * (BLOCK_WIDTH / PACKED_STEP);
+
     vec4 corners[] = {
-        {0.0f,            0.0f,            0.0f,            1.0f},
-        {0.0f,            0.0f,            CHUNK_WIDTH,     1.0f},
-        {0.0f,            CHUNK_WIDTH,     0.0f,            1.0f},
-        {0.0f,            CHUNK_WIDTH,     CHUNK_WIDTH,     1.0f},
-        {CHUNK_WIDTH,     0.0f,            0.0f,            1.0f},
-        {CHUNK_WIDTH,     0.0f,            CHUNK_WIDTH,     1.0f},
-        {CHUNK_WIDTH,     CHUNK_WIDTH,     0.0f,            1.0f},
-        {CHUNK_WIDTH,     CHUNK_WIDTH,     CHUNK_WIDTH,     1.0f}
+        {x0, y0, z0, 1.0f},
+        {x0, y0, z1, 1.0f},
+        {x0, y1, z0, 1.0f},
+        {x0, y1, z1, 1.0f},
+        {x1, y0, z0, 1.0f},
+        {x1, y0, z1, 1.0f},
+        {x1, y1, z0, 1.0f},
+        {x1, y1, z1, 1.0f}
     };
 
     // loop through each vertex, translate it, and check if it's on-screen.
@@ -928,30 +3345,14 @@ int isVisible(Chunk *chunk, mat4 view, mat4 perspective) {
 }
 
 int solidBlockInArea(World *world, int minx, int miny, int minz, int maxx, int maxy, int maxz) {
-    int x, y, z;
-    int bx, by, bz, cx, cy, cz;
+    int min[3] = {minx, miny, minz};
+    int max[3] = {maxx, maxy, maxz};
 
-    for (x = minx; x < maxx; x++) {
-        for (y = miny; y < maxy; y++) {
-            for (z = minz; z < maxz; z++) {
-                bx = x & BLOCK_MASK;
-                by = y & BLOCK_MASK;
-                bz = z & BLOCK_MASK;
-                cx = x >> LOG_CHUNK_SIZE;
-                cy = y >> LOG_CHUNK_SIZE;
-                cz = z >> LOG_CHUNK_SIZE;
-
-                if (bx >= 0 && by >= 0 && bz >= 0 &&
-                    bx < CHUNK_SIZE && by < CHUNK_SIZE && bz < CHUNK_SIZE &&
-                    cx >= 0 && cy >= 0 && cz >= 0 &&
-                    cx < world->size && cy < world->size && cz < world->size &&
-                    getBlock(getChunk(world, cx, cy, cz), bx, by, bz)->active)
-                    return 1;
-            }
-        }
-    }
+    // an empty area has nothing in it, and would shift a row by its full width
+    if (minx >= maxx || miny >= maxy || minz >= maxz)
+        return 0;
 
-    return 0;
+    return world->root && solidBlockInNode(world->root, min, max);
 }
 
 static float intbound(float s, float ds) {
@@ -966,6 +3367,27 @@ static float intbound(float s, float ds) {
     }
 }
 
+// the number of steps the ray can take along one axis before it leaves [min, min + size)
+static int stepsInside(int v, int step, int min, int size) {
+    return step > 0 ? min + size - 1 - v : step < 0 ? v - min : 0;
+}
+
+// moves the ray along one axis past every boundary it crosses before
+// time end, but no more than limit steps
+static void skipAxis(int *v, float *tMax, int step, float tDelta, float end, int limit) {
+    int n;
+
+    if (!step || *tMax >= end)
+        return;
+
+    n = ceil((end - *tMax) / tDelta);
+    if (n > limit)
+        n = limit;
+
+    *v += n * step;
+    *tMax += n * tDelta;
+}
+
 Selection selectBlock(World *world, vec3 position, vec3 direction, float radius) {
     Selection ret;
     ret.selected_active = ret.previous_active = 0;
@@ -990,45 +3412,65 @@ Selection selectBlock(World *world, vec3 position, vec3 direction, float radius)
     float tDeltaY = stepY / dy;
     float tDeltaZ = stepZ / dz;
 
-    int px = -1, py = -1, pz = -1;
+    int px = 0, py = 0, pz = 0, moved = 0;
+    int size, limitX, limitY, limitZ;
+    float tExit;
+    Chunk *chunk;
 
     if (dx == 0 && dy == 0 && dz == 0) return ret;
+    if (!world->root) return ret;
 
     while (1) {
-        if (!(x < 0 || y < 0 || z < 0 || x >= CHUNK_SIZE * world->size || y >= CHUNK_SIZE * world->size || z >= CHUNK_SIZE * world->size)) {
+        chunk = worldChunk(world, x >> LOG_CHUNK_SIZE, y >> LOG_CHUNK_SIZE, z >> LOG_CHUNK_SIZE);
+
+        // now check if the block is solid. Chunks that don't exist are all air
+        if (chunk && blockActive(chunk, blockIndex(x & BLOCK_MASK, y & BLOCK_MASK, z & BLOCK_MASK))) {
             ret.selected_chunk_x = x >> LOG_CHUNK_SIZE;
             ret.selected_chunk_y = y >> LOG_CHUNK_SIZE;
             ret.selected_chunk_z = z >> LOG_CHUNK_SIZE;
             ret.selected_block_x = x & BLOCK_MASK;
             ret.selected_block_y = y & BLOCK_MASK;
             ret.selected_block_z = z & BLOCK_MASK;
+            ret.selected_active = 1;
+
+            if (moved) {
+                ret.previous_chunk_x = px >> LOG_CHUNK_SIZE;
+                ret.previous_chunk_y = py >> LOG_CHUNK_SIZE;
+                ret.previous_chunk_z = pz >> LOG_CHUNK_SIZE;
+                ret.previous_block_x = px & BLOCK_MASK;
+                ret.previous_block_y = py & BLOCK_MASK;
+                ret.previous_block_z = pz & BLOCK_MASK;
+                ret.previous_active = 1;
+            }
 
-            // now check if the block is solid
-            if (getBlock(getChunk(world, ret.selected_chunk_x, ret.selected_chunk_y, ret.selected_chunk_z),
-                         ret.selected_block_x, ret.selected_block_y, ret.selected_block_z)->active) {
-                ret.selected_active = 1;
-
-                if (px >= 0 && py >= 0 && pz >= 0 &&
-                    px < CHUNK_SIZE * world->size &&
-                    py < CHUNK_SIZE * world->size &&
-                    pz < CHUNK_SIZE * world->size) {
-
-                    ret.previous_chunk_x = px >> LOG_CHUNK_SIZE;
-                    ret.previous_chunk_y = py >> LOG_CHUNK_SIZE;
-                    ret.previous_chunk_z = pz >> LOG_CHUNK_SIZE;
-                    ret.previous_block_x = px & BLOCK_MASK;
-                    ret.previous_block_y = py & BLOCK_MASK;
-                    ret.previous_block_z = pz & BLOCK_MASK;
-                    ret.previous_active = 1;
-                }
+            break;
+        }
 
-                break;
-            }
+        // rather than stepping through an empty octree node block by block,
+        // jump straight to the last block the ray passes through in it
+        if (!chunk || !chunk->node->count) {
+            size = CHUNK_SIZE << emptyLevel(world, x >> LOG_CHUNK_SIZE, y >> LOG_CHUNK_SIZE, z >> LOG_CHUNK_SIZE);
+
+            limitX = stepsInside(x, stepX, x & -size, size);
+            limitY = stepsInside(y, stepY, y & -size, size);
+            limitZ = stepsInside(z, stepZ, z & -size, size);
+
+            tExit = radius + 1;
+            if (stepX && tMaxX + limitX * tDeltaX < tExit) tExit = tMaxX + limitX * tDeltaX;
+            if (stepY && tMaxY + limitY * tDeltaY < tExit) tExit = tMaxY + limitY * tDeltaY;
+            if (stepZ && tMaxZ + limitZ * tDeltaZ < tExit) tExit = tMaxZ + limitZ * tDeltaZ;
+
+            if (tExit > radius) break;
+
+            skipAxis(&x, &tMaxX, stepX, tDeltaX, tExit, limitX);
+            skipAxis(&y, &tMaxY, stepY, tDeltaY, tExit, limitY);
+            skipAxis(&z, &tMaxZ, stepZ, tDeltaZ, tExit, limitZ);
         }
 
         px = x;
         py = y;
         pz = z;
+        moved = 1;
 
         if (tMaxX < tMaxY) {
             if (tMaxX < tMaxZ) {
@@ -1056,14 +3498,32 @@ Selection selectBlock(World *world, vec3 position, vec3 direction, float radius)
     return ret;
 }
 
-Block* worldBlock(World *world, int x, int y, int z) {
-    unsigned int world_block_width = world->size * CHUNK_SIZE;
+Block worldBlock(World *world, int x, int y, int z) {
+    Chunk *chunk = worldChunk(world, x >> LOG_CHUNK_SIZE, y >> LOG_CHUNK_SIZE, z >> LOG_CHUNK_SIZE);
 
-    if (x < 0 || y < 0 || z < 0 || x >= world_block_width || y >= world_block_width || z >= world_block_width)
-        return NULL;
+    if (!chunk)
+        return EMPTY_BLOCK;
+
+    return getBlock(chunk, x & BLOCK_MASK, y & BLOCK_MASK, z & BLOCK_MASK);
+}
+
+Chunk *worldChunk(World *world, int x, int y, int z) {
+    // the table is read once, since the main thread may replace it. A slot's key
+    // is only read once its chunk is there, which is stored after the key
+    ChunkTable *table = __atomic_load_n(&world->table, __ATOMIC_ACQUIRE);
+    unsigned long long key = chunkKey(x, y, z);
+    unsigned int mask = table->num_slots - 1;
+    unsigned int i = hashKey(key) & mask;
+    Chunk *chunk;
+
+    while ((chunk = __atomic_load_n(&table->slots[i].chunk, __ATOMIC_ACQUIRE))) {
+        if (table->slots[i].key == key)
+            return chunk;
+
+        i = (i + 1) & mask;
+    }
 
-    return getBlock(getChunk(world, x >> LOG_CHUNK_SIZE, y >> LOG_CHUNK_SIZE, z >> LOG_CHUNK_SIZE),
-                    x & BLOCK_MASK, y & BLOCK_MASK, z & BLOCK_MASK);
+    return NULL;
 }
 
 static void getFaceData(const GLfloat *dest, const GLfloat *src, const GLuint *indices) {
@@ -1071,8 +3531,6 @@ static void getFaceData(const GLfloat *dest, const GLfloat *src, const GLuint *i
     memcpy((void*)&dest[1*3], (void*)&src[indices[1]*3], 3 * sizeof(GLfloat));
     memcpy((void*)&dest[2*3], (void*)&src[indices[2]*3], 3 * sizeof(GLfloat));
     memcpy((void*)&dest[3*3], (void*)&src[indices[3]*3], 3 * sizeof(GLfloat));
-    memcpy((void*)&dest[4*3], (void*)&src[indices[4]*3], 3 * sizeof(GLfloat));
-    memcpy((void*)&dest[5*3], (void*)&src[indices[5]*3], 3 * sizeof(GLfloat));
 }
 
 #undef BLOCK_MASK
@@ -1,23 +1,86 @@
 #ifndef VOXELS_H_
 #define VOXELS_H_
 
+#include <sched.h>
+
 #include "matrix.h"
 #include "mesh.h"
 #include "color.h"
+#include "pool.h"
 // #include "logic.h"
 
 #define BLOCK_WIDTH 0.05
+
+// chunks can be built 16 (4), 32 (5) or 64 (6) blocks wide
+#ifndef LOG_CHUNK_SIZE
 #define LOG_CHUNK_SIZE 4
+#endif
+
 #define CHUNK_SIZE (1 << LOG_CHUNK_SIZE)
 #define CHUNK_WIDTH (CHUNK_SIZE * BLOCK_WIDTH)
 #define BLOCKS_PER_CHUNK (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)
 
-#define getBlock(chunk, x, y, z) (&chunk->blocks[x][y][z])
-#define getChunk(world, x, y, z) (world->chunks[(((x) * world->size) + (y)) * world->size + (z)])
+// models are always 16 blocks wide, whatever the chunk size. Files store
+// blocks in model sized parts, so bigger chunks are made up of several parts
+#define LOG_MODEL_SIZE 4
+#define MODEL_SIZE (1 << LOG_MODEL_SIZE)
+#define MODEL_WIDTH (MODEL_SIZE * BLOCK_WIDTH)
+
+// chunk meshes are packed with positions in steps of a block of a model inside
+// a model, which is as fine as logic blocks go. A 16 bit position then reaches
+// across chunks of up to 255 blocks
+#define PACKED_STEP (BLOCK_WIDTH / (MODEL_SIZE * MODEL_SIZE))
+#define BLOCKS_PER_PART (MODEL_SIZE * MODEL_SIZE * MODEL_SIZE)
+
+#define LOG_PARTS (LOG_CHUNK_SIZE - LOG_MODEL_SIZE)
+#define PART_MASK ((1 << LOG_PARTS) - 1)
+#define PARTS_PER_CHUNK (1 << (3 * LOG_PARTS))
+
+// part p of a chunk starts at block (partX(p), partY(p), partZ(p)) * MODEL_SIZE
+#define partX(p) ((p) >> (2 * LOG_PARTS))
+#define partY(p) (((p) >> LOG_PARTS) & PART_MASK)
+#define partZ(p) ((p) & PART_MASK)
+
+// the part of its chunk that the part at (x, y, z) (in parts) is
+#define partIndex(x, y, z) ((((x) & PART_MASK) << (2 * LOG_PARTS)) | (((y) & PART_MASK) << LOG_PARTS) | ((z) & PART_MASK))
+#define partCoord(c, offset) ((c) * (1 << LOG_PARTS) + (offset))
+
+#define getBlock(chunk, x, y, z) (chunkBlock((chunk), blockIndex(x, y, z)))
+
+// blocks are stored [x][y][z], or with MORTON_ORDER defined in Z-order, with the
+// bits of x, y and z interleaved so that neighbors along any axis are close by.
+// files are always [x][y][z] within each part, and fileIndex converts from that order
+#ifdef MORTON_ORDER
+#define blockIndex(x, y, z) ((spreadBits(x) << 2) | (spreadBits(y) << 1) | spreadBits(z))
+#define blockIndexX(i) (compactBits((i) >> 2))
+#define blockIndexY(i) (compactBits((i) >> 1))
+#define blockIndexZ(i) (compactBits(i))
+#else
+#define blockIndex(x, y, z) (((x) << (2 * LOG_CHUNK_SIZE)) | ((y) << LOG_CHUNK_SIZE) | (z))
+#define blockIndexX(i) ((i) >> (2 * LOG_CHUNK_SIZE))
+#define blockIndexY(i) (((i) >> LOG_CHUNK_SIZE) & (CHUNK_SIZE - 1))
+#define blockIndexZ(i) ((i) & (CHUNK_SIZE - 1))
+#endif
+
+#define fileIndex(n, p) (blockIndex((partX(p) << LOG_MODEL_SIZE) | ((n) >> (2 * LOG_MODEL_SIZE)), \
+                                    (partY(p) << LOG_MODEL_SIZE) | (((n) >> LOG_MODEL_SIZE) & (MODEL_SIZE - 1)), \
+                                    (partZ(p) << LOG_MODEL_SIZE) | ((n) & (MODEL_SIZE - 1))))
+#define rowIndex(y, z) (((y) << LOG_CHUNK_SIZE) | (z))
+#define blockRow(i) (rowIndex(blockIndexY(i), blockIndexZ(i)))
+#define blockBit(i) ((ChunkRow)1 << blockIndexX(i))
+#define getChunk(world, x, y, z) (worldChunk((world), (x), (y), (z)))
 
 #define selectedChunk(world, sel) (getChunk(world, (sel)->selected_chunk_x, (sel)->selected_chunk_y, (sel)->selected_chunk_z))
 #define selectedBlock(world, sel) (getBlock(selectedChunk(world, sel), (sel)->selected_block_x, (sel)->selected_block_y, (sel)->selected_block_z))
 
+#define EMPTY_BLOCK (Block){0, {.all = 0}, NULL, NULL}
+
+#define CHUNK_ROWS (CHUNK_SIZE * CHUNK_SIZE)
+#define FULL_ROW ((ChunkRow)~(ChunkRow)0)
+
+// the position of the lowest block in a row, which mustn't be empty
+#define rowLowestBit(row) ((unsigned int)__builtin_ctzll((unsigned long long)(row)))
+
 #define BIN_3(_0, _1) _0, _0, _0, _0, _0, _1, _0, _1, _0, _0, _1, _1, _1, _0, _0, _1, _0, _1, _1, _1, _0, _1, _1, _1
 
 /*
@@ -37,33 +100,264 @@
 
 struct Model_S;
 struct Logic_S;
+struct WorldNode_S;
+
+// puts two zero bits between each of the low 10 bits of v
+static inline unsigned int spreadBits(unsigned int v) {
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v <<  8)) & 0x0300F00F;
+    v = (v | (v <<  4)) & 0x030C30C3;
+    v = (v | (v <<  2)) & 0x09249249;
+    return v;
+}
+
+// the inverse of spreadBits, ignoring the bits in between
+static inline unsigned int compactBits(unsigned int v) {
+    v &= 0x09249249;
+    v = (v | (v >>  2)) & 0x030C30C3;
+    v = (v | (v >>  4)) & 0x0300F00F;
+    v = (v | (v >>  8)) & 0xFF0000FF;
+    v = (v | (v >> 16)) & 0x000003FF;
+    return v;
+}
+
+// one bit per block along x, for each (y, z) row of a chunk
+#if LOG_CHUNK_SIZE == 4
+typedef unsigned short ChunkRow;
+#elif LOG_CHUNK_SIZE == 5
+typedef unsigned int ChunkRow;
+#else
+typedef unsigned long long ChunkRow;
+#endif
+
+// palette indices, which need more than 16 bits once a chunk has more blocks than that
+#if LOG_CHUNK_SIZE <= 5
+typedef unsigned short PaletteIndex;
+#define indexMask(bits) ((1u << (bits)) - 1)
+#else
+typedef unsigned int PaletteIndex;
+#define indexMask(bits) ((unsigned int)((1ull << (bits)) - 1))
+#endif
 
 typedef struct Block_S {
     char active;
     Color color;
     struct Model_S *data;
     struct Logic_S *logic;
-    struct Block_S *nb_pos_x, *nb_pos_y, *nb_pos_z, // neighbors
-                   *nb_neg_x, *nb_neg_y, *nb_neg_z;
 } Block;
 
+// models and logic are rare, so they are kept apart from the packed colors
+typedef struct BlockExtra_S {
+    struct Model_S *data;
+    struct Logic_S *logic;
+} BlockExtra;
+
+// a model block, drawn as an instance of its model's mesh. The position is the
+// block's in its chunk, and the rotation is which of the turns of logic blocks
+// it has, see getRotationMatrix. Models that aren't logic blocks aren't turned
+typedef struct ModelInstance_S {
+    GLubyte position[3], rotation;
+} ModelInstance;
+
+// the instances of one model in a chunk's instance buffer
+typedef struct InstanceGroup_S {
+    struct Model_S *model;
+    int first, count;
+} InstanceGroup;
+
 typedef struct Chunk_S {
-    union {
-        Block blocks[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE];
-        Block blocks_lin[CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE];
-    };
+    // each block is an index into the chunk's palette, packed into
+    // index_bits bits. Entry 0 of the palette is always air. The indices
+    // are widened (1, 2, 4, 8, 16, 32 bits) as the palette fills up.
+    Color *palette;
+    unsigned int *indices;
+    unsigned int palette_size, palette_capacity;
+    unsigned char index_bits;
+
+    // set for chunks that are all air or all one color. These share read-only
+    // indices and get their own on the first store of anything else
+    char uniform;
+
+    // occupancy bits of the active blocks, kept alongside the indices
+    // (NULL for uniform chunks)
+    ChunkRow *active_rows;
+
+    // only allocated once a model or logic block is stored in the chunk,
+    // along with the occupancy bits of the models and logic blocks
+    BlockExtra *extra;
+    ChunkRow *model_rows, *logic_rows;
+
+    // how many blocks are active, and how many of them are models or logic blocks.
+    // These are kept up to date as blocks are stored
+    unsigned int num_active, num_models, num_logic;
+
+    // the box around the active blocks, from min up to but not including max, in
+    // blocks. It grows as blocks are stored, and is tightened when the chunk is meshed
+    unsigned char min[3], max[3];
+
     int x, y, z;
     Mesh *mesh;
     char needsUpdate;
+
+    // meshes are numbered as they're asked for, so that one that is built late
+    // never replaces a newer one. Pending counts those still on the mesh threads
+    unsigned int mesh_requests, mesh_shown, mesh_pending;
+
+    // chunks that are edited a block at a time keep their mesh in pieces, so that
+    // only the slices an edit changed are meshed again. Dirty has the layers of each
+    // direction that have changed since. The pieces go with the chunk's copy while a
+    // mesh thread has it, and are NULL until then
+    struct ChunkMeshCache_S *mesh_cache;
+    ChunkRow mesh_dirty[6];
+
+    // the chunks next to this one in its world, in the order -x, +x, -y, +y, -z, +z,
+    // and the cubes of theirs that touch it, which hide the faces on its sides.
+    // Each side has a row of bits per line, along y by z for the x sides, along x
+    // by z for the y sides and along x by y for the z sides
+    struct Chunk_S *neighbors[6];
+    ChunkRow borders[6][CHUNK_SIZE];
+
+    // the mesh only has the cubes. Model blocks are drawn as instances, sorted into
+    // a group per model, and built again on the main thread when they've changed
+    GLuint instance_buffer;
+    InstanceGroup *instance_groups;
+    int num_instance_groups;
+    char instancesNeedUpdate;
+
+    // set while the chunk is waiting to be remeshed by commitEdit
+    char edited;
+
+    // held by whichever thread is changing the chunk. The version is odd while
+    // something that is read without the lock is being changed, see beginChunkRead
+    int locked;
+    unsigned int version;
+
+    // set when a block is stored, so streamed worlds know what to write back
+    char modified;
+
+    // the chunk's leaf in the world's octree, NULL if it isn't in a world
+    struct WorldNode_S *node;
 } Chunk;
 
+// the octree over the chunks of a world. A node at level l covers 2^l chunks
+// along each side, starting at chunk ((x << l) - NODE_BIAS, ...), and the leaves
+// are the chunks themselves at level 0. Missing children have nothing in them.
+// The bias keeps node coordinates positive, so that the chunks on either side
+// of 0 still end up with a common parent
+#define NODE_BIAS (1 << 20)
+#define MAX_NODE_LEVEL 21
+
+typedef struct WorldNode_S {
+    struct WorldNode_S *parent, *children[8];
+    Chunk *chunk;
+    int level, x, y, z;
+
+    // the number of active blocks below the node and their average color.
+    // uniform nodes are completely filled with that one color
+    unsigned long long count;
+    Color color;
+    char uniform;
+} WorldNode;
+
+// chunk coordinates are packed into 21 bits each
+#define chunkKey(x, y, z) ((((unsigned long long)(x) & 0x1FFFFF) << 42) | \
+                           (((unsigned long long)(y) & 0x1FFFFF) << 21) | \
+                            ((unsigned long long)(z) & 0x1FFFFF))
+
+typedef struct ChunkSlot_S {
+    unsigned long long key;
+    Chunk *chunk; // NULL if the slot is free
+} ChunkSlot;
+
+// open addressing hash table from chunk keys to chunks.
+// num_slots is a power of two, and the table is never more than half full
+typedef struct ChunkTable_S {
+    unsigned int num_slots;
+    ChunkSlot slots[];
+} ChunkTable;
+
+// where to find the blocks of a chunk of a streamed world
+typedef struct ChunkLocation_S {
+    int x, y, z;
+    char used;
+
+    struct {
+        long offset; // streaming can go on long enough for the swap file to pass 4 GiB
+        unsigned int length; // 0 for parts that are empty
+        char swapped; // swapped parts are in the swap file rather than the world file
+    } parts[PARTS_PER_CHUNK];
+} ChunkLocation;
+
+typedef struct WorldStream_S {
+    FILE *file, *swap;
+
+    // the bytes in the swap file, and how many of them are parts still in use.
+    // Parts written again leave their old bytes behind until it's compacted
+    long swap_size, swap_used;
+
+    // open addressing hash table of everything that can be loaded
+    unsigned int num_locations, num_slots;
+    ChunkLocation *locations;
+
+    // chunks within radius of the center are kept loaded. The offsets around
+    // the center are sorted nearest first, and loaded in that order
+    int radius, center[3];
+    unsigned int num_offsets, next_offset;
+    int (*offsets)[3];
+
+    // chunks that were unloaded, but that the logic thread may still be using
+    unsigned int num_unloaded;
+    Chunk **unloaded;
+} WorldStream;
+
 typedef struct World_S {
+    // the size of the area the world was created with. Chunks can be added
+    // anywhere, but the player starts out above the middle of it
     unsigned int size;
-    unsigned int num_chunks;
 
+    // every chunk in the world, in the order they were added.
+    // chunks are only allocated once something is stored in them
+    unsigned int num_chunks, max_chunks;
     Chunk **chunks;
+
+    ChunkTable *table;
+
+    // NULL while the world has no chunks. It grows upwards as chunks are added
+    // further away, and is only used from the main thread. The nodes come from
+    // the world's own pool, and are all freed at once along with the world
+    WorldNode *root;
+    Pool nodes;
+
+    // arrays replaced while growing, which the logic thread may still be
+    // reading. They are freed along with the world
+    void **retired;
+    unsigned int num_retired;
+
+    // NULL unless the world was opened with openWorld
+    WorldStream *stream;
 } World;
 
+// a batch of changes to a world. The chunks they touch are remeshed once,
+// when the edit is committed, rather than after every block
+typedef struct Edit_S {
+    World *world;
+    Chunk *last; // the chunk of the last block edited, since edits tend to be close together
+    Chunk **chunks;
+    unsigned int num_chunks, max_chunks;
+} Edit;
+
+// arrays to mesh chunks into, kept from one rebuild to the next so that they only
+// grow. Each thread that meshes chunks has its own. The binary mesher also sorts
+// faces into sorted, and meshes one slice at a time into the slice arrays, which
+// are allocated the first time they're needed
+typedef struct MeshScratch_S {
+    GLfloat *points, *normals, *colors;
+    int capacity;
+
+    struct SliceFaces_S *sorted;
+    GLfloat *slice_points, *slice_normals, *slice_colors;
+} MeshScratch;
+
 typedef struct Selection_S {
     int selected_active;
     int selected_chunk_x, selected_chunk_y, selected_chunk_z;
@@ -78,19 +372,36 @@ typedef struct Selection_S {
 
 Chunk * createChunk();
 void copyChunk(Chunk *dest, Chunk *src);
+void copyChunkPart(Chunk *dest, Chunk *src, int x, int y, int z);
 void renderChunk(Chunk *chunk);
+void reserveMeshScratch(MeshScratch *scratch, int size);
+void freeMeshScratch(MeshScratch *scratch);
+int buildChunkArrays(Chunk *chunk, MeshScratch *scratch);
+int buildChunkVertices(Chunk *chunk, MeshScratch *scratch, PackedVertex **vertices);
+void uploadChunkMesh(Chunk *chunk, PackedVertex *vertices, int num_vertices);
+Chunk *copyChunkForMeshing(Chunk *chunk);
+void updateChunkInstances(Chunk *chunk);
+void keepMeshCache(Chunk *chunk, Chunk *copy);
 void freeChunk(Chunk *chunk);
 
 // worlds
 
-World * createWorld();
+World * createWorld(unsigned int size);
+Chunk *addChunk(World *world, int x, int y, int z);
+Chunk *removeChunk(World *world, int x, int y, int z);
 void fillWorld(World *world);
 void drawWorld(World *world, mat4 viewMatrix, mat4 projectionMatrix);
+void drawWorldModels(World *world, mat4 viewMatrix, mat4 projectionMatrix);
+void coarseChunk(World *world, Chunk *chunk, int level, int x, int y, int z);
 void freeWorld(World *world);
 
 // I/O
 
 World *readWorld(char *file_path);
+World *openWorld(char *file_path, int radius);
+int streamMoved(World *world, vec3 position);
+int streamWorld(World *world, vec3 position);
+void freeUnloadedChunks(World *world);
 void writeWorld(World *world, char *file_path);
 char readChunk(Chunk *chunk, FILE *in);
 void writeChunk(Chunk *chunk, FILE *out);
@@ -99,16 +410,163 @@ void writeChunk(Chunk *chunk, FILE *out);
 
 Selection selectBlock(World *world, vec3 position, vec3 direction, float radius);
 
-Block* worldBlock(World *world, int x, int y, int z);
+Block worldBlock(World *world, int x, int y, int z);
+Chunk *worldChunk(World *world, int x, int y, int z);
 
 int isVisible(Chunk *chunk, mat4 view, mat4 perspective);
 void setBlock(Chunk *chunk, int x, int y, int z, Block block);
+void storeBlock(Chunk *chunk, int x, int y, int z, Block block);
+
+// edits, in world block coordinates
+
+Edit *beginEdit(World *world);
+void editBlock(Edit *edit, int x, int y, int z, Block block);
+void fillRegion(Edit *edit, int minx, int miny, int minz, int maxx, int maxy, int maxz, Block block);
+void copyRegion(Edit *edit, World *src, int minx, int miny, int minz, int maxx, int maxy, int maxz, int x, int y, int z);
+void copyChunks(Edit *edit, World *src, int minx, int miny, int minz, int maxx, int maxy, int maxz, int x, int y, int z);
+void commitEdit(Edit *edit);
+
+static inline unsigned int blockPaletteIndex(const Chunk *chunk, int i) {
+    unsigned int bit = i * chunk->index_bits;
+
+    return (chunk->indices[bit >> 5] >> (bit & 31)) & indexMask(chunk->index_bits);
+}
+
+static inline ChunkRow chunkActiveRow(const Chunk *chunk, int row) {
+    if (chunk->active_rows)
+        return chunk->active_rows[row];
+
+    // uniform chunks are either full or empty
+    return (chunk->palette_size > 1) ? FULL_ROW : 0;
+}
+
+// the plain, colored cubes in a row, which hide the faces of whatever is next to them
+static inline ChunkRow chunkCubeRow(const Chunk *chunk, int row) {
+    return chunkActiveRow(chunk, row) & ~(chunk->model_rows ? chunk->model_rows[row] : 0);
+}
+
+// logic blocks are drawn as models, so they count as models here too. A chunk
+// without models is only plain cubes
+#define chunkHasModels(chunk) ((chunk)->num_models != 0)
+#define chunkHasLogic(chunk) ((chunk)->num_logic != 0)
+
+// the logic thread changes the logic blocks of chunks while the main thread edits
+// them, so whichever is changing a chunk in a world holds its lock. Changes to what
+// other threads read without locking, the blocks themselves and the models and
+// rotations of the logic blocks, also bump the version. Readers take the version
+// before reading and read again if it changed, so they never wait on each other
+static inline void lockChunk(Chunk *chunk) {
+    while (__atomic_exchange_n(&chunk->locked, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+static inline void unlockChunk(Chunk *chunk) {
+    __atomic_store_n(&chunk->locked, 0, __ATOMIC_RELEASE);
+}
+
+// the lock must be held from before beginChunkChange until after endChunkChange
+static inline void beginChunkChange(Chunk *chunk) {
+    __atomic_store_n(&chunk->version, chunk->version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void endChunkChange(Chunk *chunk) {
+    __atomic_store_n(&chunk->version, chunk->version + 1, __ATOMIC_RELEASE);
+}
+
+static inline void beginChunkWrite(Chunk *chunk) {
+    lockChunk(chunk);
+    beginChunkChange(chunk);
+}
+
+static inline void endChunkWrite(Chunk *chunk) {
+    endChunkChange(chunk);
+    unlockChunk(chunk);
+}
+
+// waits out any change that is being made, and returns the version to pass to chunkChanged
+static inline unsigned int beginChunkRead(const Chunk *chunk) {
+    unsigned int version;
+
+    while ((version = __atomic_load_n(&chunk->version, __ATOMIC_ACQUIRE)) & 1)
+        sched_yield();
+
+    return version;
+}
+
+// whether the chunk was changed since beginChunkRead, in which case what was read may be torn
+static inline int chunkChanged(const Chunk *chunk, unsigned int version) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&chunk->version, __ATOMIC_RELAXED) != version;
+}
+
+static inline int blockActive(const Chunk *chunk, int i) {
+    return !!(chunkActiveRow(chunk, blockRow(i)) & blockBit(i));
+}
+
+static inline int blockIsCube(const Chunk *chunk, int i) {
+    return !!(chunkCubeRow(chunk, blockRow(i)) & blockBit(i));
+}
+
+static inline Block chunkBlock(const Chunk *chunk, int i) {
+    Block block = EMPTY_BLOCK;
+
+    block.color = chunk->palette[blockPaletteIndex(chunk, i)];
+
+    if (chunk->extra) {
+        block.data = chunk->extra[i].data;
+        block.logic = chunk->extra[i].logic;
+    }
+
+    block.active = block.color.all || block.data;
+
+    return block;
+}
+
+// neighbors are found by coordinate rather than stored per block.
+// (x, y, z) are local to chunk, and are moved into the returned chunk.
+// world may be NULL for model chunks, in which case anything outside
+// of the chunk has no neighbor.
+static inline Chunk *getNeighborChunk(World *world, Chunk *chunk, int *x, int *y, int *z) {
+    int wx, wy, wz;
+
+    // fast path: the neighbor is in the same chunk
+    if (!((*x | *y | *z) & ~(CHUNK_SIZE - 1)))
+        return chunk;
+
+    if (!world)
+        return NULL;
+
+    wx = chunk->x * CHUNK_SIZE + *x;
+    wy = chunk->y * CHUNK_SIZE + *y;
+    wz = chunk->z * CHUNK_SIZE + *z;
+
+    *x = wx & (CHUNK_SIZE - 1);
+    *y = wy & (CHUNK_SIZE - 1);
+    *z = wz & (CHUNK_SIZE - 1);
+
+    return worldChunk(world, wx >> LOG_CHUNK_SIZE, wy >> LOG_CHUNK_SIZE, wz >> LOG_CHUNK_SIZE);
+}
+
+// for the main thread, which is the only one that edits chunks. The logic
+// thread reads its neighbors under the chunk's version instead
+static inline struct Logic_S *getNeighborLogic(World *world, Chunk *chunk, int x, int y, int z, int dx, int dy, int dz) {
+    x += dx; y += dy; z += dz;
+
+    chunk = getNeighborChunk(world, chunk, &x, &y, &z);
+
+    return (chunk && chunk->extra) ? chunk->extra[blockIndex(x, y, z)].logic : NULL;
+}
 
 // utils
 
 int countChunkSize(Chunk *chunk);
+unsigned int chunkMemory(Chunk *chunk);
 int renderChunkToArrays(Chunk *chunk, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale);
 int renderChunkWithMeshing(Chunk *chunk, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale);
+int renderChunkWithBinaryMeshing(Chunk *chunk, MeshScratch *scratch, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale);
+int renderChunkCubes(Chunk *chunk, MeshScratch *scratch, GLfloat *points, GLfloat *normals, GLfloat *colors, vec3 offset, float scale);
 
 void buildBlockFrame(Mesh *mesh);
 int solidBlockInArea(World *world, int minx, int miny, int minz, int maxx, int maxy, int maxz);